@@ -26,9 +26,9 @@
     .pin_ws          = I2S_CLOCK_PIN_BASE + 1,
     .sample_rate     = 44100,
     .pio_num         = 0, // 0 for pio0, 1 for pio1
+    .num_buffers     = 2,   // rendered as the DMA frees them, so short
+    .buffer_frames   = 256, // buffers are safe: 11.6 ms latency
   };
-
-  repeating_timer_t i2s_timer;
 #endif
 
 int main() {
@@ -36,6 +36,9 @@ int main() {
   // If you run it at the default speed, expect an offset
   // with the output frequencies.
   set_sys_clock_khz(FCLKSYS / 1000, true);
+  // For another clock or sample rate, also call
+  // set_output_rates(clock_hz, sample_rate) here, and pass the same
+  // rate in sound_config.
   stdio_init_all();
 
   // Start the synth.
@@ -47,7 +50,10 @@ int main() {
   #elif USE_AUDIO_I2S
     sound_i2s_init(&sound_config);
     sound_i2s_playback_start();
-    add_repeating_timer_ms(10, i2s_timer_callback, NULL, &i2s_timer);
+    // Render each buffer as soon as it has played (a repeating timer
+    // calling i2s_timer_callback() works too, with a ring long enough
+    // to cover its period)
+    start_i2s_dma_rendering();
   #endif
 
   sleep_ms(2000);
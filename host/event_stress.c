@@ -0,0 +1,121 @@
+/* event_stress.c
+ * Stress test for the engine event queue: a producer thread posts note,
+ * parameter and control events as fast as it can while the main thread
+ * renders blocks and drains them. Reports the throughput, the queue
+ * depth and the dropped events, and fails if an event is lost or
+ * applied twice.
+ *
+ * usage: event_stress [-n events] [-r]
+ *   -r  retry when the queue is full instead of dropping the event
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "pico_synth_ex.h"
+#include "host_perf.h"
+
+static synth_t engine;
+static uint32_t num_events = 1000000;
+static bool retry;
+static volatile bool producer_done;
+static uint32_t producer_dropped;
+static uint32_t retries; // failed posts of events that went through later
+
+static synth_event_t make_event(uint32_t n) {
+  synth_event_t ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.time = engine.frame_count;
+  switch (n & 3) {
+    case 0: ev.type = SYNTH_EVENT_NOTE_ON;  ev.key = 36 + (n >> 2) % 48; break;
+    case 1: ev.type = SYNTH_EVENT_NOTE_OFF; ev.key = 36 + (n >> 2) % 48; break;
+    case 2:
+      ev.type = SYNTH_EVENT_SET_PARAMETER;
+      ev.set.parameter = FILTER_CUTOFF;
+      ev.set.value = (n >> 2) % 121;
+      break;
+    case 3:
+      ev.type = SYNTH_EVENT_CONTROL_MESSAGE;
+      ev.message = (n & 4) ? LFO_DEPTH_INC : LFO_DEPTH_DEC;
+      break;
+  }
+  return ev;
+}
+
+static void *producer(void *arg) {
+  (void) arg;
+  for (uint32_t n = 0; n < num_events; ++n) {
+    synth_event_t ev = make_event(n);
+    while (!synth_post_event(&engine, &ev)) {
+      sched_yield(); // let the renderer run
+      if (!retry) { ++producer_dropped; break; }
+      ++retries;
+    }
+  }
+  // The last event always gets through: every note must end up off
+  synth_event_t off;
+  memset(&off, 0, sizeof(off));
+  off.type = SYNTH_EVENT_ALL_NOTES_OFF;
+  off.time = engine.frame_count;
+  while (!synth_post_event(&engine, &off)) { sched_yield(); ++retries; }
+  producer_done = true;
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      num_events = strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "-r") == 0) {
+      retry = true;
+    } else {
+      fprintf(stderr, "usage: event_stress [-n events] [-r]\n");
+      return 2;
+    }
+  }
+
+  synth_init(&engine);
+  synth_t *synths[1] = { &engine };
+  static int16_t buffer[2 * 64] __attribute__((aligned(4)));
+  uint32_t blocks = 0;
+
+  host_perf_init();
+  host_perf_sample_t start, end;
+  host_perf_read(&start);
+  pthread_t thread;
+  pthread_create(&thread, NULL, producer, NULL);
+  while (!producer_done || engine.events.tail != engine.events.head) {
+    synth_render(synths, 1, buffer, 64);
+    ++blocks;
+    sched_yield(); // waiting for the next buffer, as on the device
+  }
+  pthread_join(thread, NULL);
+  host_perf_read(&end);
+  host_perf_sample_t d = host_perf_delta(&start, &end);
+
+  uint32_t applied = engine.events.tail;
+  uint32_t dropped = engine.events.dropped - retries;
+  double seconds = d.ns / 1e9;
+  printf("events          : %u (+1 all notes off)%s\n", num_events,
+         retry ? ", retried when full" : "");
+  printf("applied         : %u\n", applied);
+  printf("dropped         : %u (%.2f%%)\n", dropped,
+         100.0 * dropped / (num_events + 1));
+  printf("max queue depth : %u of %u\n", engine.events.max_depth,
+         SYNTH_EVENT_QUEUE_SIZE);
+  printf("blocks rendered : %u (%.1f events per block)\n", blocks,
+         blocks ? (double) applied / blocks : 0.0);
+  printf("throughput      : %.0f events/s\n",
+         seconds > 0 ? applied / seconds : 0.0);
+
+  bool ok = (applied + dropped == num_events + 1) &&
+            (dropped == producer_dropped) && (!retry || dropped == 0);
+  if (retry) printf("full on post    : %u times\n", retries);
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    ok &= (engine.gate_voice[id] == 0);
+  }
+  printf("result          : %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
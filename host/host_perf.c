@@ -0,0 +1,86 @@
+/* host_perf.c */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "host_perf.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+static int fd_cycles = -1;
+static int fd_instructions = -1;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+#ifdef __linux__
+static int open_counter(uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  int fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  return fd;
+}
+#endif
+
+static uint64_t read_counter(int fd) {
+  uint64_t value = 0;
+  if (read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+  return value;
+}
+
+void host_perf_init(void) {
+#ifdef __linux__
+  if (fd_cycles < 0) fd_cycles = open_counter(PERF_COUNT_HW_CPU_CYCLES);
+  if (fd_instructions < 0) {
+    fd_instructions = open_counter(PERF_COUNT_HW_INSTRUCTIONS);
+  }
+#endif
+}
+
+void host_perf_read(host_perf_sample_t *sample) {
+  sample->ns = now_ns();
+  if (fd_cycles >= 0) {
+    sample->cycles = read_counter(fd_cycles);
+  } else {
+#ifdef HAVE_TSC
+    sample->cycles = __rdtsc();
+#else
+    sample->cycles = sample->ns;
+#endif
+  }
+  sample->instructions =
+      (fd_instructions >= 0) ? read_counter(fd_instructions) : 0;
+}
+
+bool host_perf_has_instructions(void) {
+  return fd_instructions >= 0;
+}
+
+const char *host_perf_cycles_source(void) {
+  if (fd_cycles >= 0) return "cpu-cycles";
+#ifdef HAVE_TSC
+  return "tsc";
+#else
+  return "ns";
+#endif
+}
@@ -0,0 +1,33 @@
+/* host_perf.h
+ * Cycle and instruction counters for the host tools. Hardware counters
+ * are read through perf_event_open when the kernel allows it; otherwise
+ * cycles fall back to the time stamp counter (or the monotonic clock)
+ * and instructions are reported as unavailable.
+ */
+
+#ifndef HOST_PERF_H_
+#define HOST_PERF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+  uint64_t ns;
+  uint64_t cycles;
+  uint64_t instructions;
+} host_perf_sample_t;
+
+void host_perf_init(void);
+void host_perf_read(host_perf_sample_t *sample);
+bool host_perf_has_instructions(void);
+const char *host_perf_cycles_source(void);
+
+// Difference between two readings
+static inline host_perf_sample_t host_perf_delta(const host_perf_sample_t *a,
+                                                 const host_perf_sample_t *b) {
+  host_perf_sample_t d = { b->ns - a->ns, b->cycles - a->cycles,
+                           b->instructions - a->instructions };
+  return d;
+}
+
+#endif
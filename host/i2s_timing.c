@@ -0,0 +1,163 @@
+/* i2s_timing.c
+ * Runs the I2S output on a simulated clock: the DMA plays a ring of
+ * buffers, a timer polls for free buffers to render (all of them, as
+ * i2s_timer_callback does) or the refill interrupt of the driver asks
+ * for them as the DMA frees them, and each render takes a set time.
+ * Every scenario is deterministic, and the driver must report the
+ * underruns, double renders and margins that it leads to.
+ *
+ * Events come in at a steady pace; their latency is the time until the
+ * first frame rendered after them plays, so it covers the ring and the
+ * wait for the next render.
+ *
+ * usage: i2s_timing [-s seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico_synth_ex.h"
+#include "sound_i2s.h"
+#include "hardware/irq.h"
+
+typedef struct {
+  const char *name;
+  uint8_t num_buffers;
+  uint16_t buffer_frames;
+  uint32_t timer_us;  // polling period, 0 to render on the DMA refill
+  uint32_t render_us; // time taken by a render
+  bool no_ownership;  // render the next buffer on every poll, as if the
+                      // driver did not track which buffers are rendered
+  bool expect_underruns;
+  bool expect_double_renders;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+  { "in time",      2, 1024, 10000,  2000, false, false, false },
+  { "slow render",  2, 1024, 10000, 25000, false, true,  false },
+  { "late timer",   2, 1024, 30000,  1000, false, true,  false },
+  { "no ownership", 2, 1024, 10000,  1000, true,  false, true  },
+  { "small ring",   3,   64,  1000,   150, false, false, false },
+  { "small, slow",  3,   64, 10000,   150, false, true,  false },
+  { "deep ring",    8,  128,  2000,   300, false, false, false },
+  { "timer 2x64",   2,   64,  1000,   600, false, true,  false },
+  { "dma refill",   2, 1024,     0,  2000, false, false, false },
+  { "dma 2x64",     2,   64,     0,   600, false, false, false },
+  { "dma 2x32",     2,   32,     0,   300, false, false, false },
+  { "dma, slow",    2,   64,     0,  1600, false, true,  false },
+};
+
+#define EVENT_PERIOD_US 997 // input events, out of step with the buffers
+
+static uint64_t buffer_us;  // play time of one buffer
+static uint64_t next_dma_us; // the DMA finishes the playing buffer
+static bool refill_requested;
+
+static void refill_callback(void) {
+  refill_requested = true;
+}
+
+// Let the DMA finish every buffer due by time t
+static void play_until(uint64_t t) {
+  while (next_dma_us <= t) {
+    host_set_time_us(next_dma_us);
+    host_irq_fire(DMA_IRQ_0);
+    next_dma_us += buffer_us;
+  }
+  host_set_time_us(t);
+}
+
+static bool run(const scenario_t *sc, uint64_t duration_us) {
+  synth_t *synths[1] = { get_synth_state() };
+  struct sound_i2s_config config = { .sample_rate = FS,
+                                     .num_buffers = sc->num_buffers,
+                                     .buffer_frames = sc->buffer_frames };
+  if (sound_i2s_init(&config)) { printf("%s: no ring\n", sc->name); return false; }
+  host_set_time_us(0);
+  sound_i2s_playback_start();
+  buffer_us = (uint64_t) sc->buffer_frames * 1000000u / FS;
+  next_dma_us = buffer_us;
+  sound_i2s_set_refill_callback(sc->timer_us ? NULL : refill_callback);
+  startup_chord();
+
+  uint32_t renders = 0;
+  uint64_t next_event_us = 0;
+  uint64_t event_latency_us = 0, max_event_latency_us = 0;
+  uint32_t events = 0;
+  for (uint64_t t = 0; t < duration_us; ) {
+    play_until(t);
+    refill_requested = false;
+    uint64_t end = t;
+    int16_t *buffer;
+    do {
+      buffer = sc->no_ownership ? sound_i2s_get_next_buffer()
+                                : sound_i2s_begin_render();
+      if (buffer) {
+        // Render n follows the silence and the n renders before it, so it
+        // plays after n + 1 buffers when there is no underrun
+        uint64_t play_us = (renders + 1) * buffer_us;
+        for (; next_event_us <= end; next_event_us += EVENT_PERIOD_US) {
+          uint64_t latency = play_us - next_event_us;
+          event_latency_us += latency;
+          if (latency > max_event_latency_us) max_event_latency_us = latency;
+          ++events;
+        }
+        synth_render(synths, 1, buffer, sc->buffer_frames);
+        end += sc->render_us;
+        play_until(end); // the DMA keeps going meanwhile
+        sound_i2s_end_render(buffer);
+        ++renders;
+      }
+    } while (buffer && !sc->no_ownership);
+    if (sc->timer_us) {
+      // The next poll is due on the timer, or right away if it was missed
+      uint64_t next = t + sc->timer_us;
+      t = (end > next) ? end : next;
+    } else {
+      // The refill interrupt runs once the DMA frees a buffer, right away
+      // if it did during the renders
+      t = refill_requested ? end : next_dma_us;
+    }
+  }
+  sound_i2s_set_refill_callback(NULL);
+
+  struct sound_i2s_stats stats;
+  sound_i2s_get_stats(&stats);
+  bool ok = ((stats.underruns > 0) == sc->expect_underruns) &&
+            ((stats.double_renders > 0) == sc->expect_double_renders) &&
+            (sc->expect_underruns || sc->no_ownership ||
+             stats.min_margin_us > 0);
+  printf("%-12s : %u x %4u frames (%4.1f ms), %5u played, %5u renders, "
+         "%4u underruns, %3u double renders, worst margin %+6d us, ",
+         sc->name, sc->num_buffers, sc->buffer_frames,
+         sound_i2s_get_latency_us() / 1000.0,
+         sound_i2s_num_buffers_played, renders, stats.underruns,
+         stats.double_renders, (int) stats.min_margin_us);
+  if (stats.underruns == 0 && !sc->no_ownership) {
+    printf("event latency %4.1f ms avg %4.1f ms max",
+           event_latency_us / 1000.0 / events, max_event_latency_us / 1000.0);
+  } else {
+    printf("event latency   -- (no steady ring)  ");
+  }
+  printf(" : %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  double seconds = 2.0;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: i2s_timing [-s seconds]\n");
+      return 2;
+    }
+  }
+
+  bool ok = true;
+  for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); ++s) {
+    ok &= run(&scenarios[s], (uint64_t) (seconds * 1e6));
+  }
+  printf("result       : %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
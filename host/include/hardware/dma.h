@@ -0,0 +1,123 @@
+/* Host shim for hardware/dma.h
+ * A simulated DMA controller. Channels hold their configuration as plain
+ * memory and move nothing by themselves: the host program stands in for
+ * the peripherals and calls host_dma_dreq() each time one asks for data.
+ * A channel that finishes its transfers triggers the channel it is chained
+ * to, which goes on from its own read address as the hardware does, and
+ * raises the DMA interrupt it is enabled on, through host_irq_fire().
+ */
+
+#ifndef HOST_HARDWARE_DMA_H_
+#define HOST_HARDWARE_DMA_H_
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUM_DMA_CHANNELS 12
+
+enum dma_channel_transfer_size {
+  DMA_SIZE_8 = 0,
+  DMA_SIZE_16 = 1,
+  DMA_SIZE_32 = 2,
+};
+
+typedef struct {
+  uint8_t size;         // enum dma_channel_transfer_size
+  bool read_increment;
+  bool write_increment;
+  uint dreq;
+  uint chain_to;        // the channel itself for no chaining
+} dma_channel_config;
+
+struct host_dma_channel {
+  bool claimed;
+  bool busy;
+  dma_channel_config config;
+  const volatile void *read_addr;
+  volatile void *write_addr;
+  uint32_t transfer_count; // transfers left
+  uint32_t count;          // transfers per trigger
+  bool irq0_enabled, irq1_enabled;
+  bool irq_raised;         // finished, until acknowledged
+  uint32_t transfers;      // done since the start
+};
+
+extern struct host_dma_channel host_dma_channels[NUM_DMA_CHANNELS];
+// Requests that found no busy channel paced by them, since the start
+extern uint32_t host_dma_starved;
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+
+static inline dma_channel_config dma_channel_get_default_config(uint channel) {
+  dma_channel_config c = { DMA_SIZE_32, true, false, 0x3f, channel };
+  return c;
+}
+
+static inline void channel_config_set_transfer_data_size(
+    dma_channel_config *c, enum dma_channel_transfer_size size) {
+  c->size = size;
+}
+
+static inline void channel_config_set_read_increment(dma_channel_config *c,
+                                                     bool incr) {
+  c->read_increment = incr;
+}
+
+static inline void channel_config_set_write_increment(dma_channel_config *c,
+                                                      bool incr) {
+  c->write_increment = incr;
+}
+
+static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) {
+  c->dreq = dreq;
+}
+
+static inline void channel_config_set_chain_to(dma_channel_config *c,
+                                               uint chain_to) {
+  c->chain_to = chain_to;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config,
+                           volatile void *write_addr,
+                           const volatile void *read_addr,
+                           uint32_t transfer_count, bool trigger);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr,
+                               bool trigger);
+void dma_start_channel_mask(uint32_t chan_mask);
+void dma_channel_abort(uint channel);
+
+static inline bool dma_channel_is_busy(uint channel) {
+  return host_dma_channels[channel].busy;
+}
+
+static inline void dma_channel_set_irq0_enabled(uint channel, bool enabled) {
+  host_dma_channels[channel].irq0_enabled = enabled;
+}
+
+static inline void dma_channel_set_irq1_enabled(uint channel, bool enabled) {
+  host_dma_channels[channel].irq1_enabled = enabled;
+}
+
+static inline bool dma_channel_get_irq1_status(uint channel) {
+  return host_dma_channels[channel].irq1_enabled &&
+         host_dma_channels[channel].irq_raised;
+}
+
+static inline void dma_channel_acknowledge_irq1(uint channel) {
+  host_dma_channels[channel].irq_raised = false;
+}
+
+// Host only: a peripheral asks for one transfer on dreq. Every channel
+// paced by it that is busy makes one; a channel that the one finishing
+// triggers waits for the next request. No busy channel counts as starved.
+void host_dma_dreq(uint dreq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
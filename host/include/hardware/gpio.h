@@ -0,0 +1,34 @@
+/* Host shim for hardware/gpio.h */
+
+#ifndef HOST_HARDWARE_GPIO_H_
+#define HOST_HARDWARE_GPIO_H_
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum gpio_function {
+  GPIO_FUNC_XIP = 0,
+  GPIO_FUNC_SPI = 1,
+  GPIO_FUNC_UART = 2,
+  GPIO_FUNC_I2C = 3,
+  GPIO_FUNC_PWM = 4,
+  GPIO_FUNC_SIO = 5,
+  GPIO_FUNC_PIO0 = 6,
+  GPIO_FUNC_PIO1 = 7,
+  GPIO_FUNC_GPCK = 8,
+  GPIO_FUNC_USB = 9,
+  GPIO_FUNC_NULL = 0x1f,
+};
+
+static inline void gpio_set_function(uint gpio, enum gpio_function fn) {
+  (void) gpio; (void) fn;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
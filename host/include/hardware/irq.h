@@ -0,0 +1,46 @@
+/* Host shim for hardware/irq.h
+ * Handlers are only recorded; a host program raises an interrupt by
+ * calling host_irq_fire().
+ */
+
+#ifndef HOST_HARDWARE_IRQ_H_
+#define HOST_HARDWARE_IRQ_H_
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PWM_IRQ_WRAP 4
+#define DMA_IRQ_0    11
+#define DMA_IRQ_1    12
+#define FIRST_USER_IRQ 26
+#define NUM_USER_IRQS 6
+#define HOST_NUM_IRQS 32
+
+#define PICO_HIGHEST_IRQ_PRIORITY 0x00
+#define PICO_DEFAULT_IRQ_PRIORITY 0x80
+#define PICO_LOWEST_IRQ_PRIORITY  0xff
+
+typedef void (*irq_handler_t)(void);
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+static inline void irq_set_priority(uint num, uint8_t hardware_priority) {
+  (void) num; (void) hardware_priority;
+}
+// A pending interrupt runs when host_irq_fire() returns, as a lower
+// priority interrupt would once the handler that raised it is done
+void irq_set_pending(uint num);
+int user_irq_claim_unused(bool required);
+
+// Host only: run the handler of an enabled interrupt, if any, then the
+// interrupts that it made pending
+bool host_irq_fire(uint num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+/* Host shim for hardware/pwm.h
+ * Slice registers are plain memory so that host programs can read back
+ * the levels written by the engine (or by a DMA channel).
+ */
+
+#ifndef HOST_HARDWARE_PWM_H_
+#define HOST_HARDWARE_PWM_H_
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUM_PWM_SLICES 8
+
+enum pwm_chan { PWM_CHAN_A = 0, PWM_CHAN_B = 1 };
+
+#define DREQ_PWM_WRAP0 24
+
+// Compare levels as in the hardware register: channel A in the low half,
+// B in the high half, so that a DMA channel can write both at once
+struct host_pwm_slice {
+  uint16_t top;
+  uint16_t ctr;
+  volatile uint32_t cc;
+  bool enabled;
+  bool irq_enabled;
+};
+
+typedef struct {
+  struct host_pwm_slice slice[NUM_PWM_SLICES];
+} pwm_hw_t;
+
+extern pwm_hw_t host_pwm_hw;
+#define pwm_hw (&host_pwm_hw)
+
+static inline uint pwm_gpio_to_slice_num(uint gpio) {
+  return (gpio >> 1u) & 7u;
+}
+
+static inline uint pwm_gpio_to_channel(uint gpio) {
+  return gpio & 1u;
+}
+
+static inline void pwm_set_wrap(uint slice_num, uint16_t wrap) {
+  pwm_hw->slice[slice_num].top = wrap;
+}
+
+static inline void pwm_set_chan_level(uint slice_num, uint chan,
+                                      uint16_t level) {
+  uint32_t shift = chan ? 16 : 0;
+  pwm_hw->slice[slice_num].cc =
+      (pwm_hw->slice[slice_num].cc & ~(0xFFFFu << shift)) |
+      ((uint32_t) level << shift);
+}
+
+static inline void pwm_set_enabled(uint slice_num, bool enabled) {
+  pwm_hw->slice[slice_num].enabled = enabled;
+}
+
+static inline void pwm_set_irq_enabled(uint slice_num, bool enabled) {
+  pwm_hw->slice[slice_num].irq_enabled = enabled;
+}
+
+static inline void pwm_clear_irq(uint slice_num) {
+  (void) slice_num;
+}
+
+static inline uint16_t pwm_get_counter(uint slice_num) {
+  return pwm_hw->slice[slice_num].ctr;
+}
+
+static inline uint pwm_get_dreq(uint slice_num) {
+  return DREQ_PWM_WRAP0 + slice_num;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
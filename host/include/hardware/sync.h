@@ -0,0 +1,31 @@
+/* Host shim for hardware/sync.h
+ * The memory barriers map to C11 fences, which also order the
+ * accesses between the threads standing in for the two cores.
+ */
+
+#ifndef HOST_HARDWARE_SYNC_H_
+#define HOST_HARDWARE_SYNC_H_
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline void __dmb(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+static inline void __mem_fence_acquire(void) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+static inline void __mem_fence_release(void) {
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Host interrupts only run when the program fires them, never in between
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+static inline void restore_interrupts(uint32_t status) { (void) status; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
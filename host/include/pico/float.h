@@ -0,0 +1,8 @@
+/* Host shim for pico/float.h: the host libm is used instead. */
+
+#ifndef HOST_PICO_FLOAT_H_
+#define HOST_PICO_FLOAT_H_
+
+#include <math.h>
+
+#endif
@@ -0,0 +1,29 @@
+/* Host shim for pico/multicore.h
+ * Core 1 is a POSIX thread and the inter-core FIFOs are lock-free rings,
+ * so code written for the RP2040's second core runs unchanged on the host.
+ */
+
+#ifndef HOST_PICO_MULTICORE_H_
+#define HOST_PICO_MULTICORE_H_
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIO_FIFO_DEPTH 8 // same depth as the RP2040 FIFOs
+
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1(void);
+void multicore_fifo_push_blocking(uint32_t data);
+uint32_t multicore_fifo_pop_blocking(void);
+bool multicore_fifo_rvalid(void);
+bool multicore_fifo_wready(void);
+uint get_core_num(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
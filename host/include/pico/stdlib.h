@@ -0,0 +1,72 @@
+/* Host shim for pico/stdlib.h
+ * Provides just enough of the Pico SDK types and calls for the synth
+ * engine to build and run on a desktop machine.
+ */
+
+#ifndef HOST_PICO_STDLIB_H_
+#define HOST_PICO_STDLIB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned int uint;
+
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t *rt);
+
+struct repeating_timer {
+  int64_t delay_us;
+  repeating_timer_callback_t callback;
+  void *user_data;
+};
+
+// Section attributes have no meaning on the host
+#define __isr
+#define __time_critical_func(func_name) func_name
+#define __not_in_flash_func(func_name) func_name
+#define __scratch_x(group)
+#define __scratch_y(group)
+
+uint64_t time_us_64(void);
+// Host only: stop the clock at us, for a program that simulates time
+// (for example the DMA timing of the I2S output); it reads us from then on
+void host_set_time_us(uint64_t us);
+static inline uint32_t time_us_32(void) { return (uint32_t) time_us_64(); }
+void sleep_us(uint64_t us);
+static inline void sleep_ms(uint32_t ms) { sleep_us((uint64_t) ms * 1000); }
+static inline void tight_loop_contents(void) {}
+
+static inline bool set_sys_clock_khz(uint32_t freq_khz, bool required) {
+  (void) freq_khz; (void) required;
+  return true;
+}
+
+static inline bool stdio_init_all(void) { return true; }
+
+// The timer is not run by the shim: the host program calls the callback
+// itself, at whatever rate it wants to simulate.
+static inline bool add_repeating_timer_ms(int32_t delay_ms,
+                                          repeating_timer_callback_t callback,
+                                          void *user_data,
+                                          repeating_timer_t *out) {
+  out->delay_us = (int64_t) delay_ms * 1000;
+  out->callback = callback;
+  out->user_data = user_data;
+  return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
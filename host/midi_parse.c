@@ -0,0 +1,230 @@
+/* midi_parse.c
+ * Checks and times the MIDI byte parser. Hand-written streams cover
+ * running status, realtime bytes inside messages, SysEx skipping and
+ * channel filtering, and must give exactly the expected engine events,
+ * fed one byte at a time or in bulk. Then a recorded stream (a capture
+ * of raw MIDI bytes with -i, or a generated keyboard performance with
+ * clock bytes) is parsed repeatedly to measure the throughput.
+ *
+ * usage: midi_parse [-i capture.bin] [-n bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico_synth_ex_midi.h"
+#include "host_perf.h"
+
+static synth_t engine;
+static synth_midi_t midi;
+
+// Take the queued events off the engine, as its renderer would
+static size_t drain(synth_event_t *out, size_t max) {
+  synth_event_queue_t *q = &engine.events;
+  size_t n = 0;
+  for (; q->tail != q->head; ++q->tail) {
+    if (n < max) { out[n++] = q->event[q->tail & (SYNTH_EVENT_QUEUE_SIZE - 1)]; }
+  }
+  return n;
+}
+
+//////// Checks //////////////////////////////////////
+#define ON(k)       { .type = SYNTH_EVENT_NOTE_ON,  .key = (k) }
+#define OFF(k)      { .type = SYNTH_EVENT_NOTE_OFF, .key = (k) }
+#define MSG(m)      { .type = SYNTH_EVENT_CONTROL_MESSAGE, .message = (m) }
+#define SET(p, v)   { .type = SYNTH_EVENT_SET_PARAMETER, .set = { (p), (v) } }
+#define PAN(p)      { .type = SYNTH_EVENT_SET_PAN, .stereo = { .pan = (p) } }
+
+typedef struct {
+  const char *name;
+  uint8_t channel;
+  uint8_t bytes[24];
+  uint8_t num_bytes;
+  synth_event_t expected[4];
+  uint8_t num_expected;
+} check_t;
+
+static const check_t checks[] = {
+  { "running status", SYNTH_MIDI_OMNI,
+    { 0x90, 60, 100, 62, 100, 64, 0 }, 7, { ON(60), ON(62), OFF(64) }, 3 },
+  { "note off", SYNTH_MIDI_OMNI,
+    { 0x80, 60, 64, 0x8F, 61, 0 }, 6, { OFF(60), OFF(61) }, 2 },
+  { "realtime inside", SYNTH_MIDI_OMNI,
+    { 0x90, 0xF8, 60, 0xFE, 100, 0xFA, 62, 0xFC, 100 }, 9,
+    { ON(60), ON(62) }, 2 },
+  { "sysex skipped", SYNTH_MIDI_OMNI,
+    { 0x90, 60, 100, 0xF0, 0x7E, 0x7F, 0xF8, 0x09, 0x01, 0xF7, 62, 100,
+      0x90, 64, 100 }, 15, { ON(60), ON(64) }, 2 },
+  { "sysex ended by status", SYNTH_MIDI_OMNI,
+    { 0xF0, 0x01, 0x02, 0x80, 60, 0 }, 6, { OFF(60) }, 1 },
+  { "system common", SYNTH_MIDI_OMNI,
+    { 0x90, 60, 100, 0xF2, 0x10, 0x20, 62, 100, 0xF3, 5, 0xF6, 64, 100 }, 13,
+    { ON(60) }, 1 },
+  { "controllers", SYNTH_MIDI_OMNI,
+    { 0xB0, 74, 127, 74, 0, 7, 100, 71, 64, 123, 0 }, 11,
+    { SET(FILTER_CUTOFF, 120), SET(FILTER_CUTOFF, 0),
+      SET(FILTER_RESONANCE, 3), MSG(ALL_NOTES_OFF) }, 4 },
+  { "program change", SYNTH_MIDI_OMNI,
+    { 0xC0, 5, 12, 0xF8, 9, 0xD0, 40 }, 7,
+    { MSG(PRESET_5), MSG(PRESET_9) }, 2 },
+  { "channel filter", 1,
+    { 0x90, 60, 100, 0x91, 61, 100, 0x92, 62, 100, 0xB1, 123, 0 }, 12,
+    { ON(61), MSG(ALL_NOTES_OFF) }, 2 },
+  { "pan", SYNTH_MIDI_OMNI,
+    { 0xB0, 10, 0, 0xB0, 10, 127, 10, 64 }, 8, { PAN(-32), PAN(32), PAN(0) }, 3 },
+  { "data without status", SYNTH_MIDI_OMNI,
+    { 60, 100, 0xE0, 0, 64, 0x90, 60 }, 7, { { 0 } }, 0 },
+};
+
+static bool same_event(const synth_event_t *a, const synth_event_t *b) {
+  if (a->type != b->type) return false;
+  switch (a->type) {
+    case SYNTH_EVENT_NOTE_ON:
+    case SYNTH_EVENT_NOTE_OFF:         return a->key == b->key;
+    case SYNTH_EVENT_CONTROL_MESSAGE:  return a->message == b->message;
+    case SYNTH_EVENT_SET_PARAMETER:
+      return a->set.parameter == b->set.parameter && a->set.value == b->set.value;
+    case SYNTH_EVENT_SET_PAN:          return a->stereo.pan == b->stereo.pan;
+    default:                           return true;
+  }
+}
+
+static bool run_check(const check_t *c, bool bulk) {
+  synth_event_t got[8];
+  synth_init(&engine);
+  synth_midi_init(&midi, &engine, c->channel);
+  if (bulk) {
+    synth_midi_parse(&midi, c->bytes, c->num_bytes);
+  } else {
+    for (uint8_t i = 0; i < c->num_bytes; ++i) {
+      synth_midi_parse_byte(&midi, c->bytes[i]);
+    }
+  }
+  size_t n = drain(got, 8);
+  bool ok = (n == c->num_expected) && (midi.messages == n);
+  for (size_t i = 0; ok && i < n; ++i) {
+    ok = same_event(&got[i], &c->expected[i]);
+  }
+  printf("%-22s %-5s %s\n", c->name, bulk ? "bulk" : "byte", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+//////// Throughput //////////////////////////////////
+static uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+  return *state = x;
+}
+
+// A keyboard performance as a controller would send it: notes with
+// running status and velocity-0 note offs, mod wheel and cutoff sweeps,
+// a program change now and then, a clock byte every 20 bytes or so
+// (wherever it falls) and a short SysEx message once in a while
+static size_t generate_stream(uint8_t *out, size_t size) {
+  uint32_t seed = 0x2468ACE1;
+  size_t n = 0;
+  uint8_t status = 0;
+  while (n + 24 < size) {
+    uint32_t r = xorshift32(&seed);
+    uint8_t msg[3];
+    uint8_t len;
+    switch (r % 16) {
+      default: msg[0] = 0x90; msg[1] = 36 + (r >> 8) % 48; msg[2] = 1 + (r >> 16) % 127; len = 3; break;
+      case 8: case 9: case 10: case 11:
+        msg[0] = 0x90; msg[1] = 36 + (r >> 8) % 48; msg[2] = 0; len = 3; break;
+      case 12: msg[0] = 0xB0; msg[1] = 1;  msg[2] = (r >> 8) & 0x7F; len = 3; break;
+      case 13: msg[0] = 0xB0; msg[1] = 74; msg[2] = (r >> 8) & 0x7F; len = 3; break;
+      case 14: msg[0] = 0xE0; msg[1] = 0;  msg[2] = (r >> 8) & 0x7F; len = 3; break;
+      case 15:
+        if ((r >> 8) % 16 == 0) {
+          out[n++] = 0xF0;
+          for (int i = 0; i < 16; ++i) { out[n++] = (r >> i) & 0x7F; }
+          out[n++] = 0xF7;
+          status = 0;
+          continue;
+        }
+        msg[0] = 0xC0; msg[1] = (r >> 8) % 10; len = 2; break;
+    }
+    for (uint8_t i = (msg[0] == status) ? 1 : 0; i < len; ++i) {
+      out[n++] = msg[i];
+      if (xorshift32(&seed) % 20 == 0) { out[n++] = 0xF8; }
+    }
+    status = msg[0];
+  }
+  return n;
+}
+
+static void time_parse(const uint8_t *stream, size_t length, uint32_t total,
+                       bool bulk) {
+  synth_init(&engine);
+  synth_midi_init(&midi, &engine, SYNTH_MIDI_OMNI);
+  host_perf_sample_t start, end;
+  host_perf_read(&start);
+  for (uint32_t done = 0; done < total; ) {
+    // Chunks of 16 bytes never hold more events than the queue takes
+    for (size_t i = 0; i < length && done < total; i += 16) {
+      size_t chunk = (length - i < 16) ? length - i : 16;
+      done += chunk;
+      if (bulk) {
+        synth_midi_parse(&midi, stream + i, chunk);
+      } else {
+        for (size_t j = 0; j < chunk; ++j) {
+          synth_midi_parse_byte(&midi, stream[i + j]);
+        }
+      }
+      engine.events.tail = engine.events.head; // consumed
+    }
+  }
+  host_perf_read(&end);
+  host_perf_sample_t d = host_perf_delta(&start, &end);
+  double seconds = d.ns / 1e9;
+  printf("%-5s : %.1f Mbytes/s, %.1f cycles/byte, %u messages, %u ignored, "
+         "%u dropped\n", bulk ? "bulk" : "byte",
+         seconds > 0 ? total / seconds / 1e6 : 0.0,
+         (double) d.cycles / total, midi.messages, midi.ignored,
+         engine.events.dropped);
+}
+
+int main(int argc, char **argv) {
+  const char *in_path = NULL;
+  uint32_t total = 1 << 24;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+      in_path = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      total = strtoul(argv[++i], NULL, 0);
+    } else {
+      fprintf(stderr, "usage: midi_parse [-i capture.bin] [-n bytes]\n");
+      return 2;
+    }
+  }
+
+  bool ok = true;
+  for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); ++c) {
+    ok &= run_check(&checks[c], false);
+    ok &= run_check(&checks[c], true);
+  }
+
+  static uint8_t stream[1 << 16];
+  size_t length;
+  if (in_path) {
+    FILE *f = fopen(in_path, "rb");
+    if (!f) { perror(in_path); return 1; }
+    length = fread(stream, 1, sizeof(stream), f);
+    fclose(f);
+  } else {
+    length = generate_stream(stream, sizeof(stream));
+  }
+  if (length == 0) { fprintf(stderr, "%s: empty\n", in_path); return 1; }
+
+  host_perf_init();
+  printf("stream: %s, %zu bytes, %u parsed (cycles: %s)\n",
+         in_path ? in_path : "generated", length, total,
+         host_perf_cycles_source());
+  time_parse(stream, length, total, false);
+  time_parse(stream, length, total, true);
+  ok &= (engine.events.dropped == 0);
+
+  printf("result: %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
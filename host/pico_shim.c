@@ -0,0 +1,238 @@
+/* pico_shim.c
+ * Host implementation of the few Pico SDK calls that need state.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/irq.h"
+#include "hardware/pwm.h"
+#include "hardware/dma.h"
+
+pwm_hw_t host_pwm_hw;
+struct host_dma_channel host_dma_channels[NUM_DMA_CHANNELS];
+uint32_t host_dma_starved;
+
+static irq_handler_t irq_handlers[HOST_NUM_IRQS];
+static bool irq_enabled[HOST_NUM_IRQS];
+static bool irq_pending[HOST_NUM_IRQS];
+static uint num_user_irqs_claimed;
+
+static bool time_simulated;
+static uint64_t simulated_time_us;
+
+void host_set_time_us(uint64_t us) {
+  simulated_time_us = us;
+  time_simulated = true;
+}
+
+uint64_t time_us_64(void) {
+  if (time_simulated) return simulated_time_us;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000u + (uint64_t) ts.tv_nsec / 1000u;
+}
+
+void sleep_us(uint64_t us) {
+  struct timespec ts = { (time_t) (us / 1000000u),
+                         (long) (us % 1000000u) * 1000 };
+  nanosleep(&ts, NULL);
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+  irq_handlers[num] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+  irq_enabled[num] = enabled;
+}
+
+void irq_set_pending(uint num) {
+  irq_pending[num] = true;
+}
+
+int user_irq_claim_unused(bool required) {
+  (void) required;
+  if (num_user_irqs_claimed == NUM_USER_IRQS) return -1;
+  return FIRST_USER_IRQ + num_user_irqs_claimed++;
+}
+
+bool host_irq_fire(uint num) {
+  if (!irq_enabled[num] || irq_handlers[num] == NULL) return false;
+  irq_handlers[num]();
+  for (uint i = 0; i < HOST_NUM_IRQS; ++i) {
+    if (irq_pending[i] && i != num) {
+      irq_pending[i] = false;
+      host_irq_fire(i);
+    }
+  }
+  return true;
+}
+
+//////// Multicore //////////////////////////////////
+// One single-producer/single-consumer ring per direction
+typedef struct {
+  uint32_t data[SIO_FIFO_DEPTH];
+  atomic_uint head; // written by the consumer
+  atomic_uint tail; // written by the producer
+} host_fifo_t;
+
+static host_fifo_t fifo_to_core[2]; // indexed by the receiving core
+static _Thread_local uint core_num;
+static pthread_t core1_thread;
+static bool core1_launched;
+
+static void wait_a_little(unsigned *spins) {
+  // Spin briefly for low latency, then give the CPU away
+  if (++*spins > 1000) sched_yield();
+}
+
+static void *core1_main(void *arg) {
+  core_num = 1;
+  ((void (*)(void)) arg)();
+  return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+  if (core1_launched) return;
+  core1_launched = true;
+  pthread_create(&core1_thread, NULL, core1_main, (void *) entry);
+}
+
+void multicore_reset_core1(void) {
+  if (!core1_launched) return;
+  pthread_cancel(core1_thread);
+  pthread_join(core1_thread, NULL);
+  core1_launched = false;
+  for (int i = 0; i < 2; ++i) {
+    atomic_store(&fifo_to_core[i].head, 0);
+    atomic_store(&fifo_to_core[i].tail, 0);
+  }
+}
+
+void multicore_fifo_push_blocking(uint32_t data) {
+  host_fifo_t *f = &fifo_to_core[!core_num];
+  unsigned tail = atomic_load_explicit(&f->tail, memory_order_relaxed);
+  unsigned spins = 0;
+  while (tail - atomic_load_explicit(&f->head, memory_order_acquire) ==
+         SIO_FIFO_DEPTH) {
+    wait_a_little(&spins);
+    pthread_testcancel();
+  }
+  f->data[tail % SIO_FIFO_DEPTH] = data;
+  atomic_store_explicit(&f->tail, tail + 1, memory_order_release);
+}
+
+uint32_t multicore_fifo_pop_blocking(void) {
+  host_fifo_t *f = &fifo_to_core[core_num];
+  unsigned head = atomic_load_explicit(&f->head, memory_order_relaxed);
+  unsigned spins = 0;
+  while (atomic_load_explicit(&f->tail, memory_order_acquire) == head) {
+    wait_a_little(&spins);
+    pthread_testcancel();
+  }
+  uint32_t data = f->data[head % SIO_FIFO_DEPTH];
+  atomic_store_explicit(&f->head, head + 1, memory_order_release);
+  return data;
+}
+
+bool multicore_fifo_rvalid(void) {
+  host_fifo_t *f = &fifo_to_core[core_num];
+  return atomic_load(&f->tail) != atomic_load(&f->head);
+}
+
+bool multicore_fifo_wready(void) {
+  host_fifo_t *f = &fifo_to_core[!core_num];
+  return atomic_load(&f->tail) - atomic_load(&f->head) < SIO_FIFO_DEPTH;
+}
+
+uint get_core_num(void) {
+  return core_num;
+}
+
+int dma_claim_unused_channel(bool required) {
+  (void) required;
+  for (uint c = 0; c < NUM_DMA_CHANNELS; ++c) {
+    if (!host_dma_channels[c].claimed) {
+      host_dma_channels[c] = (struct host_dma_channel) { .claimed = true };
+      return c;
+    }
+  }
+  return -1;
+}
+
+void dma_channel_unclaim(uint channel) {
+  host_dma_channels[channel].claimed = false;
+  host_dma_channels[channel].busy = false;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config,
+                           volatile void *write_addr,
+                           const volatile void *read_addr,
+                           uint32_t transfer_count, bool trigger) {
+  struct host_dma_channel *ch = &host_dma_channels[channel];
+  ch->config = *config;
+  ch->write_addr = write_addr;
+  ch->count = transfer_count;
+  dma_channel_set_read_addr(channel, read_addr, trigger);
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr,
+                               bool trigger) {
+  struct host_dma_channel *ch = &host_dma_channels[channel];
+  ch->read_addr = read_addr;
+  if (trigger) {
+    ch->transfer_count = ch->count;
+    ch->busy = ch->count > 0;
+  }
+}
+
+void dma_start_channel_mask(uint32_t chan_mask) {
+  for (uint c = 0; c < NUM_DMA_CHANNELS; ++c) {
+    if (chan_mask & (1u << c)) {
+      host_dma_channels[c].transfer_count = host_dma_channels[c].count;
+      host_dma_channels[c].busy = host_dma_channels[c].count > 0;
+    }
+  }
+}
+
+void dma_channel_abort(uint channel) {
+  host_dma_channels[channel].busy = false;
+}
+
+void host_dma_dreq(uint dreq) {
+  uint32_t paced = 0;
+  for (uint c = 0; c < NUM_DMA_CHANNELS; ++c) {
+    struct host_dma_channel *ch = &host_dma_channels[c];
+    paced |= (ch->claimed && ch->busy && ch->config.dreq == dreq) << c;
+  }
+  host_dma_starved += (paced == 0);
+  for (uint c = 0; c < NUM_DMA_CHANNELS; ++c) {
+    struct host_dma_channel *ch = &host_dma_channels[c];
+    if (!(paced & (1u << c))) continue;
+    size_t size = (size_t) 1 << ch->config.size;
+    memcpy((void *) ch->write_addr, (const void *) ch->read_addr, size);
+    if (ch->config.read_increment) {
+      ch->read_addr = (const volatile uint8_t *) ch->read_addr + size;
+    }
+    if (ch->config.write_increment) {
+      ch->write_addr = (volatile uint8_t *) ch->write_addr + size;
+    }
+    ch->transfers++;
+    if (--ch->transfer_count == 0) {
+      ch->busy = false;
+      ch->irq_raised = true;
+      if (ch->config.chain_to != c) {
+        dma_start_channel_mask(1u << ch->config.chain_to);
+      }
+      if (ch->irq0_enabled) host_irq_fire(DMA_IRQ_0);
+      if (ch->irq1_enabled) host_irq_fire(DMA_IRQ_1);
+    }
+  }
+}
@@ -0,0 +1,38 @@
+/* sound_i2s_host.c
+ * Host replacement for sound_i2s.c. There is no PIO or DMA: the host
+ * program stands in for the DMA controller and signals the end of each
+ * buffer with host_irq_fire(DMA_IRQ_0). The buffer ring is the one the
+ * device builds (sound_i2s_ring.c); with host_set_time_us() the program
+ * can run it on a simulated clock.
+ */
+
+#include "pico/stdlib.h"
+#include "hardware/irq.h"
+
+#include "sound_i2s.h"
+#include "sound_i2s_ring.h"
+
+static struct sound_i2s_config config;
+
+static void dma_handler(void)
+{
+  sound_i2s_ring_advance(); // the program plays it
+}
+
+int sound_i2s_init(const struct sound_i2s_config *cfg)
+{
+  config = *cfg;
+
+  if (sound_i2s_ring_init(&config) < 0) {
+    return -1;
+  }
+
+  irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
+  irq_set_enabled(DMA_IRQ_0, true);
+  return 0;
+}
+
+void sound_i2s_playback_start(void)
+{
+  sound_i2s_ring_start();
+}
@@ -0,0 +1,471 @@
+/* synth_bench.c
+ * Microbenchmarks for the DSP stages. Each stage runs in isolation over
+ * a parameter sweep with fixed-seed inputs, and the results are written
+ * as CSV (one line per case) so that runs can be diffed between commits.
+ * Samples are counted per voice, so "block" cases (the whole engine
+ * through synth_render) compare directly with "voice" ones. "sparse"
+ * cases hold one voice while the others are idle. "control"
+ * cases run the same blocks with the modulators at the control rate,
+ * "alloc" ones time note events through the voice allocator (per event
+ * instead of per sample), "stereo" ones render the blocks panned or with
+ * the voices spread (the "block" cases are centred, on a mono bus),
+ * "dual" ones with half of the voices on a second thread, "half" ones
+ * with the voices at half rate and the bus upsampled (the "silent" cases
+ * time the renderer with no voice playing, at half and at full rate:
+ * mostly the upsampler), and "pwm" ones requantize 16-bit samples to
+ * PWM levels with each noise shaping order.
+ *
+ * usage: synth_bench [-n samples_per_case] [-o results.csv] [stage ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_perf.h"
+
+// The stage functions are static: build them into this file
+#include "pico_synth_ex.c"
+
+#define NUM_INPUTS 4096 // size of the fixed-seed input tables (power of 2)
+#define VOICE_ID(i) ((i) % SYNTH_NUM_VOICES) // cycle through the voices
+
+static Q28 audio_inputs[NUM_INPUTS];
+static Q14 mod_inputs[NUM_INPUTS];
+static volatile int32_t sink; // keeps the results alive
+
+// Every case starts from a fresh engine
+static synth_t bench_synth;
+
+// Current case settings
+static render_params_t case_params;
+static uint16_t case_pitch;
+static uint8_t case_gate_period;
+
+static uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+  return *state = x;
+}
+
+static void init_inputs(void) {
+  uint32_t seed = 0x12345678;
+  for (int i = 0; i < NUM_INPUTS; ++i) {
+    audio_inputs[i] = (int32_t) xorshift32(&seed) >> 4;  // +/- 0.5 in Q28
+    mod_inputs[i]   = (int32_t) xorshift32(&seed) >> 18; // +/- 0.5 in Q14
+  }
+}
+
+//////// Stage loops ////////////////////////////////
+static int32_t run_osc(uint32_t n) {
+  int32_t acc = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    acc += Osc_process(&bench_synth, &case_params, VOICE_ID(i), case_pitch,
+                       mod_inputs[i & (NUM_INPUTS - 1)]);
+  }
+  return acc;
+}
+
+static int32_t run_filter(uint32_t n) {
+  int32_t acc = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    acc += Filter_process(&bench_synth, &case_params, VOICE_ID(i),
+                          audio_inputs[i & (NUM_INPUTS - 1)],
+                          mod_inputs[(i >> 4) & (NUM_INPUTS - 1)]);
+  }
+  return acc;
+}
+
+static int32_t run_eg(uint32_t n) {
+  int32_t acc = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    acc += EG_process(&bench_synth, &case_params, VOICE_ID(i),
+                      (i >> case_gate_period) & 1);
+  }
+  return acc;
+}
+
+static int32_t run_lfo(uint32_t n) {
+  int32_t acc = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    acc += LFO_process(&bench_synth, &case_params, VOICE_ID(i));
+  }
+  return acc;
+}
+
+static int32_t run_amp(uint32_t n) {
+  int32_t acc = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    acc += Amp_process(VOICE_ID(i), audio_inputs[i & (NUM_INPUTS - 1)],
+                       mod_inputs[(i + 7) & (NUM_INPUTS - 1)]);
+  }
+  return acc;
+}
+
+static int32_t run_voice(uint32_t n) {
+  int32_t acc = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    uint8_t id = VOICE_ID(i);
+    acc += process_voice(&bench_synth, &case_params, id,
+                         bench_synth.gate_voice[id],
+                         bench_synth.pitch_voice[id]);
+  }
+  return acc;
+}
+
+// Note events through the voice allocator, one per "sample". Chords of
+// eight notes each start before the last one is released, and the
+// arpeggio keeps six notes ringing, so both steal when there are fewer
+// voices than that.
+static uint8_t case_stream; // 0: chords, 1: arpeggio
+static uint32_t case_event;
+
+static void alloc_event(uint32_t i, bool *on, uint8_t *key) {
+  // The releases start from the second chord and the seventh note of the
+  // arpeggio: the streams open with note-ons only
+  if (case_stream == 0) {
+    i += (i >= 8) * 8;
+    uint32_t chord = i / 16, note = i % 8;
+    *on = (i % 16) < 8;
+    if (!*on) chord -= 1; // release the previous chord
+    *key = 36 + (chord * 5) % 24 + note * 4;
+  } else {
+    i = (i < 6) ? 2 * i : i + 6;
+    *on = (i & 1) == 0;
+    uint32_t step = (i >> 1) - (*on ? 0 : 6);
+    *key = 48 + (step * 3) % 36;
+  }
+}
+
+static int32_t run_alloc(uint32_t n) {
+  int32_t acc = 0;
+  for (uint32_t i = 0; i < n; ++i, ++case_event) {
+    bool on;
+    uint8_t key;
+    alloc_event(case_event, &on, &key);
+    if (on) {
+      apply_note_on(&bench_synth, key);
+    } else {
+      apply_note_off(&bench_synth, key);
+    }
+    acc += bench_synth.held_first;
+  }
+  return acc;
+}
+
+// Requantize one channel for the PWM output
+static int32_t run_pwm(uint32_t n) {
+  int32_t acc = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    acc += PWMA_level(audio_inputs[i & (NUM_INPUTS - 1)] >> 14, 0);
+  }
+  return acc;
+}
+
+// All voices through the block renderer
+static int32_t run_block(uint32_t n) {
+  static int16_t buffer[2 * 1024] __attribute__((aligned(4)));
+  synth_t *synths[1] = { &bench_synth };
+  int32_t acc = 0;
+  for (uint32_t i = 0; i < n; i += SYNTH_NUM_VOICES * 1024) {
+    synth_render(synths, 1, buffer, 1024);
+    acc += buffer[i & 1023];
+  }
+  return acc;
+}
+
+//////// Driver ////////////////////////////////////
+static FILE *out;
+static uint32_t samples_per_case = 1 << 20;
+
+// Configure bench_synth before calling this
+static void bench(const char *stage, const char *name,
+                  int32_t (*run)(uint32_t)) {
+  process_events(&bench_synth, bench_synth.frame_count);
+  load_render_params(&bench_synth, &case_params);
+  run(samples_per_case >> 4); // warm up caches and branch predictors
+
+  host_perf_sample_t start, end;
+  host_perf_read(&start);
+  sink = run(samples_per_case);
+  host_perf_read(&end);
+  host_perf_sample_t d = host_perf_delta(&start, &end);
+
+  double ns = (double) d.ns / samples_per_case;
+  double cycles = (double) d.cycles / samples_per_case;
+  double instructions = (double) d.instructions / samples_per_case;
+  printf("%-7s %-24s %8.2f ns %8.1f cycles", stage, name, ns, cycles);
+  if (host_perf_has_instructions()) printf(" %8.1f instr", instructions);
+  printf("\n");
+  if (out) {
+    fprintf(out, "%s,%s,%u,%.3f,%.2f,", stage, name, samples_per_case,
+            ns, cycles);
+    if (host_perf_has_instructions()) fprintf(out, "%.2f", instructions);
+    fprintf(out, "\n");
+  }
+}
+
+static void bench_osc(void) {
+  char name[32];
+  for (uint8_t waveform = 0; waveform <= 1; ++waveform) {
+    for (uint8_t pitch = 0; pitch <= 120; pitch += 12) {
+      synth_init(&bench_synth);
+      synth_set_parameter(&bench_synth, OSC_WAVEFORM, waveform);
+      case_pitch = pitch << 8;
+      snprintf(name, sizeof(name), "wave=%u pitch=%u", waveform, pitch);
+      bench("osc", name, run_osc);
+    }
+  }
+}
+
+static void bench_filter(void) {
+  char name[32];
+  for (uint8_t resonance = 0; resonance <= 5; ++resonance) {
+    for (uint8_t cutoff = 0; cutoff <= 120; cutoff += 30) {
+      synth_init(&bench_synth);
+      synth_set_parameter(&bench_synth, FILTER_RESONANCE, resonance);
+      synth_set_parameter(&bench_synth, FILTER_CUTOFF, cutoff);
+      synth_set_parameter(&bench_synth, FILTER_MOD_AMOUNT, 30);
+      snprintf(name, sizeof(name), "res=%u cutoff=%u", resonance, cutoff);
+      bench("filter", name, run_filter);
+    }
+  }
+}
+
+static void bench_eg(void) {
+  char name[32];
+  for (uint8_t decay = 0; decay <= 64; decay += 16) {
+    synth_init(&bench_synth);
+    synth_set_parameter(&bench_synth, EG_DECAY_TIME, decay);
+    synth_set_parameter(&bench_synth, EG_SUSTAIN_LEVEL, 32);
+    case_gate_period = 14;
+    snprintf(name, sizeof(name), "decay=%u", decay);
+    bench("eg", name, run_eg);
+  }
+}
+
+static void bench_lfo(void) {
+  char name[32];
+  for (uint8_t rate = 0; rate <= 64; rate += 32) {
+    synth_init(&bench_synth);
+    synth_set_parameter(&bench_synth, LFO_RATE, rate);
+    synth_set_parameter(&bench_synth, LFO_DEPTH, 32);
+    snprintf(name, sizeof(name), "rate=%u", rate);
+    bench("lfo", name, run_lfo);
+  }
+}
+
+static void bench_amp(void) {
+  synth_init(&bench_synth);
+  bench("amp", "random", run_amp);
+}
+
+// All voices playing, spread over two octaves
+static void start_chord(uint8_t preset) {
+  synth_init(&bench_synth);
+  apply_load_preset(&bench_synth, &presets[preset]);
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    bench_synth.pitch_voice[id] = 48 + (7 * id) % 36;
+    bench_synth.gate_voice[id] = 1;
+  }
+}
+
+static void bench_voice(void) {
+  char name[32];
+  for (uint8_t preset = 0; preset < 10; ++preset) {
+    start_chord(preset);
+    snprintf(name, sizeof(name), "preset=%u", preset);
+    bench("voice", name, run_voice);
+  }
+}
+
+static void bench_block(void) {
+  char name[32];
+  for (uint8_t preset = 0; preset < 10; ++preset) {
+    start_chord(preset);
+    snprintf(name, sizeof(name), "preset=%u", preset);
+    bench("block", name, run_block);
+  }
+}
+
+// One voice held, the others released until they have gone idle
+static void bench_sparse(void) {
+  char name[32];
+  static int16_t buffer[2 * 1024] __attribute__((aligned(4)));
+  synth_t *synths[1] = { &bench_synth };
+  for (uint8_t preset = 0; preset < 10; ++preset) {
+    start_chord(preset);
+    for (uint8_t id = 1; id < SYNTH_NUM_VOICES; ++id) {
+      bench_synth.gate_voice[id] = 0;
+    }
+    for (int i = 0; i < 10 * FS / 1024; ++i) { // 10 s of release
+      synth_render(synths, 1, buffer, 1024);
+    }
+    snprintf(name, sizeof(name), "preset=%u", preset);
+    bench("sparse", name, run_block);
+  }
+}
+
+// The voices get fixed, different EG levels for the quietest policy
+static void start_alloc(uint8_t stream, uint8_t policy) {
+  synth_init(&bench_synth);
+  synth_set_steal_policy(&bench_synth, policy);
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    bench_synth.voice[id].eg_level = audio_inputs[id] & 0x0FFFFFFF;
+  }
+  case_stream = stream;
+  case_event = 0;
+}
+
+static void bench_alloc(void) {
+  static const char *streams[] = { "chords", "arpeggio" };
+  static const char *policies[] = { "oldest", "quietest", "same-pitch" };
+  char name[48];
+  for (uint8_t stream = 0; stream < 2; ++stream) {
+    for (uint8_t policy = SYNTH_STEAL_OLDEST;
+         policy <= SYNTH_STEAL_SAME_PITCH; ++policy) {
+      start_alloc(stream, policy); // steals per note-on, on a dry run
+      run_alloc(NUM_INPUTS);
+      uint32_t steals = bench_synth.steal_count;
+      start_alloc(stream, policy);
+      snprintf(name, sizeof(name), "%s %s steals=%.0f%%", streams[stream],
+               policies[policy], 100.0 * steals / (NUM_INPUTS / 2));
+      bench("alloc", name, run_alloc);
+    }
+  }
+}
+
+// The block renderer at the control rate (compare with "block" cases)
+static void bench_control(void) {
+  char name[32];
+  for (uint8_t period = 8; period <= SYNTH_MAX_CONTROL_PERIOD; period *= 2) {
+    for (uint8_t preset = 0; preset < 10; ++preset) {
+      start_chord(preset);
+      synth_set_control_period(&bench_synth, period);
+      snprintf(name, sizeof(name), "period=%u preset=%u", period, preset);
+      bench("control", name, run_block);
+    }
+  }
+}
+
+// The block renderer with a stereo image (compare with "block" cases)
+static void bench_stereo(void) {
+  static const struct { const char *name; int8_t pan; uint8_t spread, width; }
+      images[] = { { "pan", -16, 0, 64 }, { "spread", 0, 32, 64 },
+                   { "wide", 0, 32, 128 } };
+  char name[32];
+  for (size_t s = 0; s < sizeof(images) / sizeof(images[0]); ++s) {
+    for (uint8_t preset = 0; preset < 10; ++preset) {
+      start_chord(preset);
+      synth_set_stereo(&bench_synth, images[s].pan, images[s].spread,
+                       images[s].width);
+      snprintf(name, sizeof(name), "%s preset=%u", images[s].name, preset);
+      bench("stereo", name, run_block);
+    }
+  }
+}
+
+// The block renderer with the voices split between two cores (threads)
+static void bench_dual(void) {
+  char name[32];
+  start_dual_core_rendering();
+  for (uint8_t preset = 0; preset < 10; ++preset) {
+    start_chord(preset);
+    snprintf(name, sizeof(name), "preset=%u", preset);
+    bench("dual", name, run_block);
+  }
+  stop_dual_core_rendering();
+}
+
+// The block renderer with the voices at half rate (compare with "block"
+// cases), and with no voice at all
+static void bench_half(void) {
+  char name[32];
+  set_half_rate_voices(true);
+  for (uint8_t preset = 0; preset < 10; ++preset) {
+    start_chord(preset);
+    snprintf(name, sizeof(name), "preset=%u", preset);
+    bench("half", name, run_block);
+  }
+  synth_init(&bench_synth);
+  bench("half", "silent", run_block);
+  set_half_rate_voices(false);
+  synth_init(&bench_synth);
+  bench("half", "silent full-rate", run_block);
+}
+
+// The PWM requantizer, per sample of one channel
+static void bench_pwm(void) {
+  char name[32];
+  for (uint8_t order = 0; order <= 2; ++order) {
+    synth_init(&bench_synth);
+    set_pwm_noise_shaping(order);
+    snprintf(name, sizeof(name), "shaping order=%u", order);
+    bench("pwm", name, run_pwm);
+  }
+  set_pwm_noise_shaping(0);
+}
+
+static const struct {
+  const char *name;
+  void (*run)(void);
+} stages[] = {
+  { "osc",    bench_osc    },
+  { "filter", bench_filter },
+  { "eg",     bench_eg     },
+  { "lfo",    bench_lfo    },
+  { "amp",    bench_amp    },
+  { "voice",  bench_voice  },
+  { "block",  bench_block  },
+  { "sparse", bench_sparse },
+  { "control", bench_control },
+  { "alloc",  bench_alloc  },
+  { "stereo", bench_stereo },
+  { "dual",   bench_dual   },
+  { "half",   bench_half   },
+  { "pwm",    bench_pwm    },
+};
+
+#define NUM_STAGES (sizeof(stages) / sizeof(stages[0]))
+
+int main(int argc, char **argv) {
+  const char *out_path = NULL;
+  bool selected[NUM_STAGES] = { false };
+  bool any_selected = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      samples_per_case = strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      out_path = argv[++i];
+    } else {
+      size_t s;
+      for (s = 0; s < NUM_STAGES; ++s) {
+        if (strcmp(argv[i], stages[s].name) == 0) break;
+      }
+      if (s == NUM_STAGES || samples_per_case == 0) {
+        fprintf(stderr, "usage: synth_bench [-n samples_per_case] "
+                        "[-o results.csv] [osc|filter|eg|lfo|amp|voice|block|sparse|control|alloc|stereo|dual|half|pwm ...]\n");
+        return 2;
+      }
+      selected[s] = any_selected = true;
+    }
+  }
+
+  if (out_path) {
+    out = fopen(out_path, "w");
+    if (!out) { perror(out_path); return 1; }
+    fprintf(out, "stage,case,samples,ns_per_sample,cycles_per_sample,"
+                 "instructions_per_sample\n");
+  }
+
+  init_inputs();
+  host_perf_init();
+  printf("cycles: %s, %u samples per case, %u voices\n",
+         host_perf_cycles_source(), samples_per_case, SYNTH_NUM_VOICES);
+  for (size_t s = 0; s < NUM_STAGES; ++s) {
+    if (!any_selected || selected[s]) stages[s].run();
+  }
+
+  if (out) fclose(out);
+  return 0;
+}
@@ -0,0 +1,483 @@
+/* synth_render.c
+ * Offline renderer: plays an event script through the I2S render path
+ * as fast as the CPU allows and writes the result to a WAV file.
+ *
+ * Script format, one event per line ('#' starts a comment):
+ *   <time_ms> note_on <key>
+ *   <time_ms> note_off <key>
+ *   <time_ms> note_toggle <key>
+ *   <time_ms> all_notes_off
+ *   <time_ms> preset <0-9>                 factory preset
+ *   <time_ms> preset <12 values>           Preset_t literal
+ *   <time_ms> set <PARAMETER> <value>      e.g. set FILTER_CUTOFF 80
+ *   <time_ms> control <MESSAGE>            e.g. control LFO_RATE_INC
+ *   <time_ms> end                          stop rendering
+ *
+ * Events take effect on their exact frame (see -b). Prefix a command
+ * with @<part> to send it to another engine, e.g.
+ * "0 @1 preset 5": each part has its own preset and voices, and all
+ * the parts used are mixed together (part 0 is the default engine).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pico_synth_ex.h"
+#include "sound_i2s.h"
+#include "hardware/irq.h"
+#include "host_perf.h"
+
+#define MAX_EVENTS 4096
+
+typedef enum {
+  EV_NOTE_ON,
+  EV_NOTE_OFF,
+  EV_NOTE_TOGGLE,
+  EV_ALL_NOTES_OFF,
+  EV_FACTORY_PRESET,
+  EV_PRESET,
+  EV_SET,
+  EV_CONTROL,
+  EV_END
+} event_type_t;
+
+typedef struct {
+  uint32_t frame;
+  uint8_t part;
+  event_type_t type;
+  int value;
+  int arg;
+  Preset_t preset;
+} event_t;
+
+static const char *parameter_names[] = {
+  "OCTAVE_SHIFT", "OSC_WAVEFORM", "OSC_2_COARSE_PITCH", "OSC_2_FINE_PITCH",
+  "OSC_1_2_MIX", "EG_SUSTAIN_LEVEL", "EG_DECAY_TIME", "FILTER_CUTOFF",
+  "FILTER_RESONANCE", "FILTER_MOD_AMOUNT", "LFO_DEPTH", "LFO_RATE",
+};
+
+static const char *control_names[] = {
+  "OCTAVE_SHIFT_INC", "OCTAVE_SHIFT_DEC", "EG_SUSTAIN_LEVEL_INC",
+  "EG_SUSTAIN_LEVEL_DEC", "OSC_WAVEFORM_DEC", "OSC_WAVEFORM_INC",
+  "OSC_2_COARSE_PITCH_INC", "OSC_2_COARSE_PITCH_DEC", "OSC_2_FINE_PITCH_INC",
+  "OSC_2_FINE_PITCH_DEC", "OSC_1_2_MIX_INC", "OSC_1_2_MIX_DEC",
+  "EG_DECAY_TIME_INC", "EG_DECAY_TIME_DEC", "FILTER_CUTOFF_INC",
+  "FILTER_CUTOFF_DEC", "FILTER_RESONANCE_INC", "FILTER_RESONANCE_DEC",
+  "FILTER_MOD_AMOUNT_INC", "FILTER_MOD_AMOUNT_DEC", "LFO_DEPTH_INC",
+  "LFO_DEPTH_DEC", "LFO_RATE_INC", "LFO_RATE_DEC", "ALL_NOTES_OFF",
+  "PRESET_0", "PRESET_1", "PRESET_2", "PRESET_3", "PRESET_4",
+  "PRESET_5", "PRESET_6", "PRESET_7", "PRESET_8", "PRESET_9",
+};
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static event_t events[MAX_EVENTS];
+static int num_events;
+
+static synth_t *parts[SYNTH_MAX_OUTPUTS];
+static synth_t extra_parts[SYNTH_MAX_OUTPUTS];
+static uint8_t num_parts = 1;
+
+static int find_name(const char **names, int count, const char *name) {
+  for (int i = 0; i < count; ++i) {
+    if (strcmp(names[i], name) == 0) return i;
+  }
+  return -1;
+}
+
+static int parse_preset_literal(const char *text, Preset_t *p) {
+  int v[12];
+  if (sscanf(text, "%d %d %d %d %d %d %d %d %d %d %d %d",
+             &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+             &v[6], &v[7], &v[8], &v[9], &v[10], &v[11]) != 12) return -1;
+  Preset_t preset = { v[0], v[1], v[2], v[3], v[4], v[5],
+                      v[6], v[7], v[8], v[9], v[10], v[11] };
+  *p = preset;
+  return 0;
+}
+
+static int parse_script(FILE *f, const char *path) {
+  char line[256];
+  int line_num = 0;
+  while (fgets(line, sizeof(line), f)) {
+    ++line_num;
+    char *comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+
+    double time_ms;
+    char command[32];
+    int consumed;
+    if (sscanf(line, "%lf %31s %n", &time_ms, command, &consumed) < 2) {
+      continue; // blank line
+    }
+    int part = 0;
+    if (command[0] == '@') {
+      int more;
+      part = atoi(command + 1);
+      if (part < 0 || part >= SYNTH_MAX_OUTPUTS ||
+          sscanf(line + consumed, "%31s %n", command, &more) < 1) {
+        fprintf(stderr, "%s:%d: invalid part\n", path, line_num);
+        return -1;
+      }
+      consumed += more;
+    }
+    if (num_events == MAX_EVENTS) {
+      fprintf(stderr, "%s:%d: too many events\n", path, line_num);
+      return -1;
+    }
+    const char *args = line + consumed;
+    event_t *ev = &events[num_events];
+    memset(ev, 0, sizeof(*ev));
+    ev->frame = (uint32_t) (time_ms * get_sample_rate() / 1000.0 + 0.5);
+    ev->part = part;
+    if (part >= num_parts) num_parts = part + 1;
+
+    char name[32];
+    int ok = 1;
+    if      (strcmp(command, "note_on") == 0) {
+      ev->type = EV_NOTE_ON;     ok = sscanf(args, "%d", &ev->value) == 1;
+    } else if (strcmp(command, "note_off") == 0) {
+      ev->type = EV_NOTE_OFF;    ok = sscanf(args, "%d", &ev->value) == 1;
+    } else if (strcmp(command, "note_toggle") == 0) {
+      ev->type = EV_NOTE_TOGGLE; ok = sscanf(args, "%d", &ev->value) == 1;
+    } else if (strcmp(command, "all_notes_off") == 0) {
+      ev->type = EV_ALL_NOTES_OFF;
+    } else if (strcmp(command, "preset") == 0) {
+      if (parse_preset_literal(args, &ev->preset) == 0) {
+        ev->type = EV_PRESET;
+      } else {
+        ev->type = EV_FACTORY_PRESET;
+        ok = sscanf(args, "%d", &ev->value) == 1 &&
+             ev->value >= 0 && ev->value <= 9;
+      }
+    } else if (strcmp(command, "set") == 0) {
+      ev->type = EV_SET;
+      ok = sscanf(args, "%31s %d", name, &ev->arg) == 2 &&
+           (ev->value = find_name(parameter_names,
+                                  COUNT_OF(parameter_names), name)) >= 0;
+    } else if (strcmp(command, "control") == 0) {
+      ev->type = EV_CONTROL;
+      ok = sscanf(args, "%31s", name) == 1 &&
+           (ev->value = find_name(control_names,
+                                  COUNT_OF(control_names), name)) >= 0;
+    } else if (strcmp(command, "end") == 0) {
+      ev->type = EV_END;
+    } else {
+      ok = 0;
+    }
+    if (!ok) {
+      fprintf(stderr, "%s:%d: invalid event\n", path, line_num);
+      return -1;
+    }
+    ++num_events;
+  }
+  return 0;
+}
+
+static int compare_events(const void *a, const void *b) {
+  const event_t *ea = a, *eb = b;
+  if (ea->frame != eb->frame) return (ea->frame < eb->frame) ? -1 : 1;
+  return (ea < eb) ? -1 : 1; // keep script order for equal times
+}
+
+// Queue a script event on its part, due at the given frame
+static bool post_event(const event_t *ev, uint32_t time) {
+  synth_event_t e;
+  memset(&e, 0, sizeof(e));
+  e.time = time;
+  switch (ev->type) {
+    case EV_NOTE_ON:        e.type = SYNTH_EVENT_NOTE_ON;       e.key = ev->value;                break;
+    case EV_NOTE_OFF:       e.type = SYNTH_EVENT_NOTE_OFF;      e.key = ev->value;                break;
+    case EV_NOTE_TOGGLE:    e.type = SYNTH_EVENT_NOTE_TOGGLE;   e.key = ev->value;                break;
+    case EV_ALL_NOTES_OFF:  e.type = SYNTH_EVENT_ALL_NOTES_OFF;                                   break;
+    case EV_FACTORY_PRESET: e.type = SYNTH_EVENT_CONTROL_MESSAGE; e.message = PRESET_0 + ev->value; break;
+    case EV_PRESET:         e.type = SYNTH_EVENT_LOAD_PRESET;   e.preset = ev->preset;            break;
+    case EV_SET:            e.type = SYNTH_EVENT_SET_PARAMETER;
+                            e.set.parameter = ev->value;        e.set.value = ev->arg;            break;
+    case EV_CONTROL:        e.type = SYNTH_EVENT_CONTROL_MESSAGE; e.message = ev->value;          break;
+    case EV_END:            return true;
+  }
+  return synth_post_event(parts[ev->part], &e);
+}
+
+static void put_u16(FILE *f, uint16_t v) {
+  fputc(v & 0xFF, f); fputc(v >> 8, f);
+}
+
+static int get_u16(FILE *f) {
+  int lo = fgetc(f), hi = fgetc(f);
+  return (hi == EOF) ? EOF : lo | (hi << 8);
+}
+
+static void put_u32(FILE *f, uint32_t v) {
+  put_u16(f, v & 0xFFFF); put_u16(f, v >> 16);
+}
+
+static void write_wav_header(FILE *f, uint32_t num_frames) {
+  uint32_t data_size = num_frames * 4;
+  fwrite("RIFF", 1, 4, f); put_u32(f, 36 + data_size);
+  fwrite("WAVE", 1, 4, f);
+  fwrite("fmt ", 1, 4, f); put_u32(f, 16);
+  put_u16(f, 1);           // PCM
+  put_u16(f, 2);           // stereo
+  put_u32(f, get_sample_rate());
+  put_u32(f, get_sample_rate() * 4); // byte rate
+  put_u16(f, 4);           // block align
+  put_u16(f, 16);          // bits per sample
+  fwrite("data", 1, 4, f); put_u32(f, data_size);
+}
+
+static void usage(void) {
+  fprintf(stderr,
+      "usage: synth_render [-p preset] [-P \"v1 ... v12\"] [-o out.wav]\n"
+      "                    [-t seconds] [-2] [-k samples]\n"
+      "                    [-c ref.wav [-m min_db]] [-b]\n"
+      "                    [-r buffers] [-f frames] [-d]\n"
+      "                    [-s pan,spread,width] [-R rate[,clock]] [-H] [-T]\n"
+      "                    script.txt\n"
+      "  -p  start all parts from factory preset 0-9 (default 0)\n"
+      "  -P  start all parts from a Preset_t literal\n"
+      "  -o  output WAV file (default: no output)\n"
+      "  -t  length when the script has no 'end' event (default 2 s\n"
+      "      after the last event)\n"
+      "  -2  render half of the voices on a second core (thread)\n"
+      "  -k  control period: evaluate the EG, LFO and filter cutoff once\n"
+      "      every 1, 2, 4 ... 32 samples (default 1)\n"
+      "  -c  compare with a WAV file written by -o and print the SNR\n"
+      "  -m  fail when the SNR is below min_db\n"
+      "  -b  apply the events at the start of their buffer, like a\n"
+      "      firmware polling loop, instead of on their exact frame\n"
+      "  -r  I2S buffers in the ring (default 2)\n"
+      "  -f  frames per I2S buffer (default 1024)\n"
+      "  -d  render each buffer when the DMA frees it, instead of polling\n"
+      "  -s  stereo image of all parts (default 0,0,64: centred, mono)\n"
+      "  -R  sample rate and system clock in Hz (default 44100,120000000)\n"
+      "  -H  render the voices at half the sample rate and upsample\n"
+      "  -T  turn the half-rate voices on and back off before -H, which\n"
+      "      must leave the tables as they were\n");
+}
+
+int main(int argc, char **argv) {
+  const char *out_path = NULL;
+  const char *script_path = NULL;
+  int factory_preset = 0;
+  const char *preset_literal = NULL;
+  double length_s = -1;
+  bool dual_core = false;
+  int control_period = 1;
+  const char *ref_path = NULL;
+  double min_snr_db = -1e9;
+  bool buffer_timing = false;
+  bool dma_refill = false;
+  bool half_rate = false;
+  bool toggle_half_rate = false;
+  int pan = 0, spread = 0, width = 64;
+  unsigned rate = FS, sys_clock = FCLKSYS;
+  struct sound_i2s_config config = { .sample_rate = FS };
+
+  for (int i = 1; i < argc; ++i) {
+    if      (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_path = argv[++i];
+    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) factory_preset = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) preset_literal = argv[++i];
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) length_s = atof(argv[++i]);
+    else if (strcmp(argv[i], "-2") == 0) dual_core = true;
+    else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) control_period = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) ref_path = argv[++i];
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) min_snr_db = atof(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0) buffer_timing = true;
+    else if (strcmp(argv[i], "-d") == 0) dma_refill = true;
+    else if (strcmp(argv[i], "-H") == 0) half_rate = true;
+    else if (strcmp(argv[i], "-T") == 0) toggle_half_rate = true;
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%d,%d,%d", &pan, &spread, &width) != 3) {
+        usage();
+        return 2;
+      }
+    }
+    else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%u,%u", &rate, &sys_clock) < 1) {
+        usage();
+        return 2;
+      }
+    }
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) config.num_buffers = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) config.buffer_frames = atoi(argv[++i]);
+    else if (argv[i][0] != '-' && !script_path) script_path = argv[i];
+    else { usage(); return 2; }
+  }
+  if (!script_path || factory_preset < 0 || factory_preset > 9 ||
+      !set_output_rates(sys_clock, rate) ||
+      (toggle_half_rate && (!set_half_rate_voices(true) ||
+                            !set_half_rate_voices(false))) ||
+      !set_half_rate_voices(half_rate)) {
+    usage();
+    return 2;
+  }
+  config.sample_rate = rate;
+
+  FILE *script = fopen(script_path, "r");
+  if (!script) { perror(script_path); return 1; }
+  int err = parse_script(script, script_path);
+  fclose(script);
+  if (err) return 1;
+  qsort(events, num_events, sizeof(event_t), compare_events);
+
+  uint32_t total_frames = 0;
+  for (int i = 0; i < num_events; ++i) {
+    if (events[i].type == EV_END) { total_frames = events[i].frame; break; }
+  }
+  if (total_frames == 0) {
+    uint32_t last = num_events ? events[num_events - 1].frame : 0;
+    total_frames = (length_s >= 0) ? (uint32_t) (length_s * rate)
+                                   : last + 2 * rate;
+  }
+
+  if (sound_i2s_init(&config)) { usage(); return 2; }
+  const uint32_t buffer_frames = sound_i2s_get_buffer_frames();
+  const uint32_t ring_buffers = sound_i2s_get_num_buffers();
+  uint32_t num_buffers = (total_frames + buffer_frames - 1) / buffer_frames;
+  total_frames = num_buffers * buffer_frames;
+
+  parts[0] = get_synth_state();
+  for (uint8_t k = 1; k < num_parts; ++k) {
+    parts[k] = &extra_parts[k];
+    synth_init(parts[k]);
+  }
+  set_output_synths(parts, num_parts);
+
+  Preset_t preset;
+  for (uint8_t k = 0; k < num_parts; ++k) {
+    if (preset_literal) {
+      if (parse_preset_literal(preset_literal, &preset)) { usage(); return 2; }
+      synth_load_preset(parts[k], preset);
+    } else {
+      synth_control_message(parts[k], PRESET_0 + factory_preset);
+    }
+    if (!synth_set_control_period(parts[k], control_period) ||
+        !synth_set_stereo(parts[k], pan, spread, width)) {
+      usage();
+      return 2;
+    }
+  }
+
+  FILE *out = NULL;
+  if (out_path) {
+    out = fopen(out_path, "wb");
+    if (!out) { perror(out_path); return 1; }
+    write_wav_header(out, total_frames);
+  }
+  FILE *ref = NULL;
+  if (ref_path) {
+    ref = fopen(ref_path, "rb");
+    if (!ref) { perror(ref_path); return 1; }
+    fseek(ref, 44, SEEK_SET); // canonical header, as written above
+  }
+  double signal_energy = 0, error_energy = 0;
+
+  sound_i2s_playback_start();
+  if (dual_core) start_dual_core_rendering();
+
+  host_perf_init();
+  host_perf_sample_t total = { 0, 0, 0 };
+  uint32_t checksum = 2166136261u; // FNV-1a over the rendered samples
+  int next_event = 0;
+  int lost_events = 0;
+
+  for (uint32_t n = 0; n < num_buffers; ++n) {
+    // Events are queued before the buffers that the callback renders
+    // (all the free ones of the ring, and with -d the one that the refill
+    // interrupt renders next), due on their own frame (or on the first
+    // frame of their buffer with -b)
+    uint32_t render_end = (n + ring_buffers - !dma_refill) * buffer_frames;
+    while (next_event < num_events && events[next_event].frame < render_end) {
+      const event_t *ev = &events[next_event++];
+      uint32_t buffer_start = ev->frame - ev->frame % buffer_frames;
+      lost_events += !post_event(ev, buffer_timing ? buffer_start : ev->frame);
+    }
+
+    int16_t *buffer = sound_i2s_get_next_buffer();
+    host_perf_sample_t start, end;
+    host_perf_read(&start);
+    if (!dma_refill) {
+      i2s_timer_callback(NULL);
+    } else if (n == 0) {
+      start_i2s_dma_rendering();
+    }
+    // The buffer is now playing (with -d, the one it follows is rendered
+    // again by the refill interrupt)
+    host_irq_fire(DMA_IRQ_0);
+    host_perf_read(&end);
+    host_perf_sample_t d = host_perf_delta(&start, &end);
+    total.ns += d.ns; total.cycles += d.cycles;
+    total.instructions += d.instructions;
+
+    // Frames are 32-bit words, left in the upper half: WAV order is left
+    // first
+    for (uint32_t i = 0; i < buffer_frames * 2; ++i) {
+      uint16_t s = (uint16_t) buffer[i ^ 1];
+      checksum = (checksum ^ (s & 0xFF)) * 16777619u;
+      checksum = (checksum ^ (s >> 8)) * 16777619u;
+      if (out) put_u16(out, s);
+      if (ref) {
+        int r = get_u16(ref);
+        double r_value = (r == EOF) ? 0 : (int16_t) r;
+        double e = r_value - (int16_t) s;
+        signal_energy += r_value * r_value;
+        error_energy += e * e;
+      }
+    }
+  }
+  if (out) fclose(out);
+  if (dual_core) stop_dual_core_rendering();
+  if (dma_refill) stop_i2s_dma_rendering();
+  // Once the output has rendered, the rates are those it started with
+  bool rates_locked = !set_output_rates(sys_clock, rate) &&
+                      !set_half_rate_voices(!half_rate);
+
+  double audio_s = (double) total_frames / rate;
+  double render_s = total.ns / 1e9;
+  printf("frames          : %u (%.3f s at %u Hz)\n", total_frames, audio_s, rate);
+  printf("engines         : %u x %u bytes, %u bytes of shared tables\n",
+         num_parts, (unsigned) sizeof(synth_t),
+         (unsigned) synth_tables_size());
+  printf("i2s ring        : %u x %u frames, %.1f ms latency\n",
+         ring_buffers, buffer_frames, sound_i2s_get_latency_us() / 1000.0);
+  printf("render time     : %.6f s\n", render_s);
+  printf("realtime factor : %.1fx\n", render_s > 0 ? audio_s / render_s : 0.0);
+  printf("cycles/sample   : %.1f (%s)\n",
+         (double) total.cycles / total_frames, host_perf_cycles_source());
+  if (host_perf_has_instructions()) {
+    printf("instr/sample    : %.1f\n",
+           (double) total.instructions / total_frames);
+  }
+  synth_load_t load;
+  get_output_load(&load);
+  printf("output load     : %u.%02u%% moving avg, %u.%02u%% peak of the deadline, "
+         "%u cycles per buffer\n",
+         load.average_load / 100, load.average_load % 100,
+         load.peak_load / 100, load.peak_load % 100, load.average_cycles);
+  printf("load histogram  :");
+  for (int i = 0; i < SYNTH_LOAD_BINS; ++i) printf(" %u", load.histogram[i]);
+  printf(" (10%% bins, then overruns)\n");
+  uint32_t max_lateness = 0;
+  for (uint8_t k = 0; k < num_parts; ++k) {
+    if (parts[k]->events.max_lateness > max_lateness) {
+      max_lateness = parts[k]->events.max_lateness;
+    }
+  }
+  printf("event timing    : %s, %u frames late at most, %d lost\n",
+         buffer_timing ? "buffer start" : "exact frame", max_lateness,
+         lost_events);
+  printf("rates locked    : %s\n", rates_locked ? "yes" : "NO");
+  printf("checksum        : %08x\n", checksum);
+  if (!rates_locked) return 1;
+  if (ref) {
+    fclose(ref);
+    double snr_db = (error_energy > 0)
+        ? 10 * log10(signal_energy / error_energy) : INFINITY;
+    printf("snr vs reference: %.1f dB\n", snr_db);
+    if (snr_db < min_snr_db) return 1;
+  }
+  return 0;
+}
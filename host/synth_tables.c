@@ -0,0 +1,271 @@
+/* synth_tables.c
+ * Generates pico_synth_ex_tables.h from the formulas of
+ * pico_synth_ex_table_formulas.h, for a sample rate, a wave table size
+ * and a number of harmonics, and reports the size of each table. -c
+ * compares the tables with the ones shipped in the repository (at their
+ * settings, the defaults) and tells which are bit-exact.
+ *
+ * The shipped wave and filter tables were computed on the RP2040, whose
+ * float library rounds some sines and cosines differently from the host:
+ * a few wave samples differ by one step, and some filter coefficients by
+ * one float rounding of cos(w0). The other tables are bit-exact, and -c
+ * fails for any difference past those.
+ *
+ * usage: synth_tables [-r rate] [-w wave_bits] [-m max_harmonics]
+ *                     [-o tables.h] [-c]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico_synth_ex.h"
+
+// The shipped tables, under other names
+#define Osc_freq_table     shipped_Osc_freq_table
+#define Osc_tune_table     shipped_Osc_tune_table
+#define Osc_wave_tables    shipped_Osc_wave_tables
+#define Osc_mix_table      shipped_Osc_mix_table
+#define LFO_freq_table     shipped_LFO_freq_table
+#define EG_exp_table       shipped_EG_exp_table
+#define Filter_coefs_table shipped_Filter_coefs_table
+#include "pico_synth_ex_tables.h"
+#undef Osc_freq_table
+#undef Osc_tune_table
+#undef Osc_wave_tables
+#undef Osc_mix_table
+#undef LFO_freq_table
+#undef EG_exp_table
+#undef Filter_coefs_table
+
+#define NUM_WAVEFORMS 2
+#define NUM_WAVE_TABLES 31
+#define NUM_RESONANCES 6
+#define NUM_CUTOFFS 481
+
+// Every table as a flat array of values
+typedef struct {
+  const char *declaration; // up to the name, e.g. "static uint32_t"
+  const char *name;
+  const char *comment;
+  uint32_t dims[3];        // dimensions, 0 past the last
+  bool is_struct;          // the last dimension is a struct FILTER_COEFS
+  size_t value_size;       // bytes
+  bool is_signed;
+  const void *shipped;     // the same table in the repository
+  size_t max_differ;       // values that may differ from it (-c)
+  int64_t max_difference;  // and by how much
+  size_t count;            // values
+  int64_t *values;
+} table_t;
+
+static uint32_t sample_rate = FS;
+static uint8_t wave_bits = OSC_WAVE_TABLE_BITS;
+static uint16_t max_harmonics = OSC_WAVE_MAX_HARMONICS;
+
+static int64_t shipped_value(const table_t *t, size_t i) {
+  if (t->value_size == 2) return ((const int16_t *) t->shipped)[i];
+  if (t->is_signed) return ((const int32_t *) t->shipped)[i];
+  return ((const uint32_t *) t->shipped)[i];
+}
+
+static void generate(table_t *tables) {
+  float fs = (float) sample_rate;
+  float ratio = fs / FORMULA_REFERENCE_RATE;
+  uint32_t wave_size = 1u << wave_bits;
+  table_t *t = tables;
+
+  for (uint8_t i = 0; i < 122; ++i) { t->values[i] = formula_osc_freq(i, fs); }
+  ++t;
+  for (uint16_t i = 0; i < 256; ++i) { t->values[i] = formula_osc_tune(i); }
+  ++t;
+  for (uint8_t w = 0; w < NUM_WAVEFORMS; ++w) {
+    for (uint8_t k = 0; k < NUM_WAVE_TABLES; ++k) {
+      uint16_t harmonics = formula_osc_harmonics(k, fs, max_harmonics);
+      int64_t *table = t->values + (w * NUM_WAVE_TABLES + k) * wave_size;
+      for (uint32_t n = 0; n < wave_size; ++n) {
+        table[n] = formula_osc_wave(w, harmonics, n, wave_size);
+      }
+    }
+  }
+  ++t;
+  for (uint8_t i = 0; i < 65; ++i) { t->values[i] = formula_osc_mix(i); }
+  ++t;
+  for (uint8_t i = 0; i < 65; ++i) { t->values[i] = formula_lfo_freq(i, fs); }
+  ++t;
+  for (uint8_t i = 0; i < 65; ++i) { t->values[i] = formula_eg_period(i, ratio); }
+  ++t;
+  float max_f0 = formula_filter_max_f0(ratio);
+  for (uint8_t r = 0; r < NUM_RESONANCES; ++r) {
+    for (uint16_t c = 0; c < NUM_CUTOFFS; ++c) {
+      struct FILTER_COEFS coefs = formula_filter_coefs(r, c, fs, max_f0);
+      int64_t *v = t->values + (r * NUM_CUTOFFS + c) * 3;
+      v[0] = coefs.b0_a0; v[1] = coefs.a1_a0; v[2] = coefs.a2_a0;
+    }
+  }
+}
+
+// The values of dimension d and below, one brace level per dimension,
+// in rows of 8 (16 for 16-bit values) or one struct per row
+static void write_values(FILE *f, const table_t *t, size_t *i, uint8_t d) {
+  bool last = d == 2 || t->dims[d + 1] == 0;
+  if (!last) {
+    // The struct dimension writes its own braces
+    bool braces = !t->is_struct || (d + 2 < 3 && t->dims[d + 2]);
+    for (uint32_t j = 0; j < t->dims[d]; ++j) {
+      if (braces) fprintf(f, "{\n");
+      write_values(f, t, i, d + 1);
+      if (braces) fprintf(f, "},\n");
+    }
+    return;
+  }
+  uint32_t per_line = t->is_struct ? t->dims[d] : 32 / t->value_size;
+  for (uint32_t j = 0; j < t->dims[d]; ++j, ++*i) {
+    bool first = j % per_line == 0;
+    bool end = j % per_line == per_line - 1 || j == t->dims[d] - 1;
+    fprintf(f, "%s%lld%s", first ? (t->is_struct ? "{" : "  ") : " ",
+            (long long) t->values[*i],
+            end ? (t->is_struct ? "},\n" : ",\n") : ",");
+  }
+}
+
+static void write_table(FILE *f, const table_t *t) {
+  fprintf(f, "%s %s", t->declaration, t->name);
+  for (uint8_t d = 0; d < 3 && t->dims[d]; ++d) {
+    if (!t->is_struct || (d + 1 < 3 && t->dims[d + 1])) fprintf(f, "[%u]", t->dims[d]);
+  }
+  fprintf(f, " = {%s%s\n", t->comment ? " // " : "", t->comment ? t->comment : "");
+  size_t i = 0;
+  write_values(f, t, &i, 0);
+  fprintf(f, "};\n\n");
+}
+
+static void write_header(FILE *f, const table_t *tables, size_t num_tables) {
+  fprintf(f, "/* pico_synth_ex_tables.h\n"
+             " * Generated by synth_tables -r %u -w %u -m %u: do not edit\n"
+             " */\n\n", sample_rate, wave_bits, max_harmonics);
+  fprintf(f, "#ifndef PICO_SYNTH_EX_TABLES_H_\n#define PICO_SYNTH_EX_TABLES_H_\n\n");
+  fprintf(f, "#if FS != %u\n#error \"these tables are for FS %u\"\n#endif\n\n",
+          sample_rate, sample_rate);
+  fprintf(f, "#define OSC_WAVE_TABLE_BITS %u\n", wave_bits);
+  fprintf(f, "#include \"pico_synth_ex_table_formulas.h\"\n\n");
+  for (size_t k = 0; k < num_tables; ++k) write_table(f, &tables[k]);
+  fprintf(f, "#endif\n");
+}
+
+static void usage(void) {
+  fprintf(stderr,
+      "usage: synth_tables [-r rate] [-w wave_bits] [-m max_harmonics]\n"
+      "                    [-o tables.h] [-c]\n"
+      "  -r  sample rate of the tables (default %u)\n"
+      "  -w  log2 samples per wave table, 6 to 18 (default %u)\n"
+      "  -m  harmonics of the lowest wave tables (default %u)\n"
+      "  -o  write the header\n"
+      "  -c  compare with the shipped tables (default settings only)\n",
+      FS, OSC_WAVE_TABLE_BITS, OSC_WAVE_MAX_HARMONICS);
+}
+
+int main(int argc, char **argv) {
+  const char *out_path = NULL;
+  bool compare = false;
+  for (int i = 1; i < argc; ++i) {
+    if      (strcmp(argv[i], "-r") == 0 && i + 1 < argc) sample_rate = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) wave_bits = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) max_harmonics = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_path = argv[++i];
+    else if (strcmp(argv[i], "-c") == 0) compare = true;
+    else { usage(); return 2; }
+  }
+  bool defaults = sample_rate == FS && wave_bits == OSC_WAVE_TABLE_BITS &&
+                  max_harmonics == OSC_WAVE_MAX_HARMONICS;
+  if (sample_rate < SYNTH_MIN_SAMPLE_RATE || sample_rate > SYNTH_MAX_SAMPLE_RATE ||
+      wave_bits < 6 || wave_bits > 18 || max_harmonics < 1 ||
+      (compare && !defaults)) {
+    usage();
+    return 2;
+  }
+
+  // The host differs from the RP2040 in 27 wave samples, by 1, and in
+  // 3207 filter coefficients, by up to 128: a little slack on the counts
+  table_t tables[] = {
+    { .declaration = "static uint32_t", .name = "Osc_freq_table",
+      .dims = { 122 }, .value_size = 4,
+      .shipped = shipped_Osc_freq_table },
+    { .declaration = "static const int16_t", .name = "Osc_tune_table",
+      .comment = "Q14 frequency tuning table",
+      .dims = { 256 }, .value_size = 2, .is_signed = true,
+      .shipped = shipped_Osc_tune_table },
+    { .declaration = "static int16_t", .name = "Osc_wave_tables",
+      .comment = "Q14 waveform tables",
+      .dims = { NUM_WAVEFORMS, NUM_WAVE_TABLES, 1u << wave_bits },
+      .value_size = 2, .is_signed = true,
+      .shipped = shipped_Osc_wave_tables,
+      .max_differ = 32, .max_difference = 1 },
+    { .declaration = "static int16_t", .name = "Osc_mix_table",
+      .comment = "Q14 mix table",
+      .dims = { 65 }, .value_size = 2, .is_signed = true,
+      .shipped = shipped_Osc_mix_table },
+    { .declaration = "static uint32_t", .name = "LFO_freq_table",
+      .dims = { 65 }, .value_size = 4,
+      .shipped = shipped_LFO_freq_table },
+    { .declaration = "static uint32_t", .name = "EG_exp_table",
+      .comment = "Exponential table",
+      .dims = { 65 }, .value_size = 4,
+      .shipped = shipped_EG_exp_table },
+    { .declaration = "static struct FILTER_COEFS", .name = "Filter_coefs_table",
+      .dims = { NUM_RESONANCES, NUM_CUTOFFS, 3 }, .is_struct = true,
+      .value_size = 4, .is_signed = true,
+      .shipped = shipped_Filter_coefs_table,
+      .max_differ = 3300, .max_difference = 128 },
+  };
+  const size_t num_tables = sizeof(tables) / sizeof(tables[0]);
+  for (size_t k = 0; k < num_tables; ++k) {
+    table_t *t = &tables[k];
+    t->count = 1;
+    for (uint8_t d = 0; d < 3 && t->dims[d]; ++d) t->count *= t->dims[d];
+    t->values = calloc(t->count, sizeof(int64_t));
+    if (!t->values) { perror("synth_tables"); return 1; }
+  }
+  generate(tables);
+
+  printf("settings        : %u Hz, %u samples per wave table, up to %u "
+         "harmonics%s\n", sample_rate, 1u << wave_bits, max_harmonics,
+         defaults ? " (defaults)" : "");
+  size_t total = 0;
+  bool ok = true;
+  for (size_t k = 0; k < num_tables; ++k) {
+    const table_t *t = &tables[k];
+    size_t bytes = t->count * t->value_size;
+    total += bytes;
+    printf("%-18s : %7zu bytes", t->name, bytes);
+    if (compare) {
+      size_t differ = 0;
+      int64_t max_difference = 0;
+      for (size_t i = 0; i < t->count; ++i) {
+        int64_t d = llabs(t->values[i] - shipped_value(t, i));
+        differ += (d != 0);
+        if (d > max_difference) max_difference = d;
+      }
+      if (differ == 0) {
+        printf(", bit-exact");
+      } else {
+        printf(", %zu of %zu values differ, by at most %lld", differ, t->count,
+               (long long) max_difference);
+      }
+      // Only the tables made with sines and cosines may differ, and only
+      // as far as the float libraries do
+      ok &= differ <= t->max_differ && max_difference <= t->max_difference;
+    }
+    printf("\n");
+  }
+  printf("%-18s : %7zu bytes\n", "total", total);
+
+  if (out_path) {
+    FILE *f = fopen(out_path, "w");
+    if (!f) { perror(out_path); return 1; }
+    write_header(f, tables, num_tables);
+    fclose(f);
+  }
+  for (size_t k = 0; k < num_tables; ++k) free(tables[k].values);
+  if (compare) printf("result          : %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+/* voice_alloc.c
+ * Checks the voice allocator. Scripted note sequences go through the
+ * renderer-side handlers (apply_note_on() and friends) and each step
+ * must pick the expected voice: free voices first, longest released
+ * first, then the oldest or the quietest held voice, a held pitch
+ * retriggering its own voice and, with the same-pitch policy, a released
+ * one too. Then random streams under each policy check that the voice
+ * lists stay consistent and that no voice is left playing a key that is
+ * up, after note-offs or all-notes-off. The scripts are written for 4
+ * voices; the streams run at any polyphony, over three keys per voice.
+ *
+ * usage: voice_alloc [-n events]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The handlers are static: build them into this file
+#include "pico_synth_ex.c"
+
+static synth_t engine;
+
+static uint32_t gates(void) {
+  uint32_t mask = 0;
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    mask |= (uint32_t) (engine.gate_voice[id] != 0) << id;
+  }
+  return mask;
+}
+
+#if SYNTH_NUM_VOICES == 4
+
+//////// Scripts ///////////////////////////////////////
+// '+' note on, '-' note off, 't' note toggle: voice that started or
+// stopped (-1: none). 'a' all notes off. 'l' sets the EG level of voice
+// to key << 20, for the quietest policy.
+typedef struct {
+  char op;
+  uint8_t key;
+  int8_t voice;
+} step_t;
+
+typedef struct {
+  const char *name;
+  uint8_t policy;
+  step_t steps[12];
+  uint8_t num_steps;
+  uint32_t steals;
+} script_t;
+
+#define CHORD(a, b, c, d) \
+  { '+', a, 0 }, { '+', b, 1 }, { '+', c, 2 }, { '+', d, 3 }
+
+static const script_t scripts[] = {
+  { "free voices in order", SYNTH_STEAL_OLDEST,
+    { CHORD(60, 62, 64, 65) }, 4, 0 },
+  { "oldest stolen", SYNTH_STEAL_OLDEST,
+    { CHORD(60, 62, 64, 65), { '+', 67, 0 }, { '+', 69, 1 },
+      { '-', 60, -1 }, { '-', 67, 0 } }, 8, 2 },
+  { "longest released first", SYNTH_STEAL_OLDEST,
+    { CHORD(60, 62, 64, 65), { '-', 62, 1 }, { '-', 60, 0 },
+      { '+', 67, 1 }, { '+', 69, 0 }, { '+', 71, 2 } }, 9, 1 },
+  { "held pitch retriggered", SYNTH_STEAL_OLDEST,
+    { { '+', 60, 0 }, { '+', 62, 1 }, { '+', 60, 0 }, { '+', 64, 2 },
+      { '-', 60, 0 }, { '-', 60, -1 } }, 6, 0 },
+  { "quietest stolen", SYNTH_STEAL_QUIETEST,
+    { CHORD(60, 62, 64, 65), { 'l', 30, 0 }, { 'l', 10, 1 },
+      { 'l', 40, 2 }, { 'l', 20, 3 }, { '+', 67, 1 }, { '-', 62, -1 } },
+    10, 1 },
+  { "quietest, oldest on a tie", SYNTH_STEAL_QUIETEST,
+    { CHORD(60, 62, 64, 65), { 'l', 20, 0 }, { 'l', 10, 1 },
+      { 'l', 10, 2 }, { 'l', 10, 3 }, { '+', 67, 1 } }, 9, 1 },
+  { "same pitch reused", SYNTH_STEAL_SAME_PITCH,
+    { { '+', 60, 0 }, { '+', 62, 1 }, { '-', 60, 0 }, { '+', 64, 2 },
+      { '+', 60, 0 }, { '+', 65, 3 } }, 6, 0 },
+  { "same pitch not reused", SYNTH_STEAL_OLDEST,
+    { { '+', 60, 0 }, { '+', 62, 1 }, { '-', 60, 0 }, { '+', 64, 2 },
+      { '+', 60, 3 }, { '+', 65, 0 } }, 6, 0 },
+  { "same pitch steals oldest", SYNTH_STEAL_SAME_PITCH,
+    { CHORD(60, 62, 64, 65), { '+', 67, 0 }, { '+', 60, 1 } }, 6, 2 },
+  { "all notes off", SYNTH_STEAL_OLDEST,
+    { { '+', 60, 0 }, { '+', 62, 1 }, { '+', 64, 2 }, { 'a', 0, -1 },
+      { '+', 65, 3 }, { '+', 67, 0 }, { '-', 62, -1 } }, 7, 0 },
+  { "toggle", SYNTH_STEAL_OLDEST,
+    { { 't', 60, 0 }, { 't', 62, 1 }, { 't', 60, 0 }, { 't', 64, 2 },
+      { 't', 62, 1 } }, 5, 0 },
+};
+
+// Voice that the step started or stopped, -1 for none
+static int8_t run_step(const step_t *s) {
+  uint32_t before = gates();
+  uint8_t pitch = s->key; // octave shift 0
+  switch (s->op) {
+    case '+': apply_note_on(&engine, s->key);     break;
+    case '-': apply_note_off(&engine, s->key);    break;
+    case 't': apply_note_toggle(&engine, s->key); break;
+    case 'a': apply_all_notes_off(&engine);       break;
+    case 'l': engine.voice[s->voice].eg_level = s->key << 20; return s->voice;
+  }
+  if (s->op == 'a') { return gates() ? 0 : -1; }
+  uint8_t id = engine.voice_of_pitch[pitch];
+  bool started = id != NO_VOICE && engine.gate_voice[id];
+  if (s->op == '+' || (s->op == 't' && started)) {
+    // a retriggered voice starts its attack again
+    return (started && engine.voice[id].eg_gate == 0) ? id : -1;
+  }
+  uint32_t stopped = before & ~gates();
+  for (uint8_t v = 0; v < SYNTH_NUM_VOICES; ++v) {
+    if (stopped == (1u << v)) { return v; }
+  }
+  return -1;
+}
+
+static bool run_script(const script_t *c) {
+  synth_init(&engine);
+  synth_set_steal_policy(&engine, c->policy);
+  bool ok = true;
+  for (uint8_t i = 0; ok && i < c->num_steps; ++i) {
+    for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+      engine.voice[id].eg_gate = engine.gate_voice[id]; // rendered since
+    }
+    int8_t voice = run_step(&c->steps[i]);
+    if (voice != c->steps[i].voice) {
+      printf("%-28s step %u: voice %d, expected %d\n", c->name, i, voice,
+             c->steps[i].voice);
+      ok = false;
+    }
+  }
+  ok &= (engine.steal_count == c->steals);
+  printf("%-28s %s (%u steals)\n", c->name, ok ? "ok" : "FAILED",
+         engine.steal_count);
+  return ok;
+}
+#endif
+
+//////// Random streams ////////////////////////////////
+static uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+  return *state = x;
+}
+
+// The lists hold every voice once, the held ones gated, and a gated
+// voice plays a key that is down
+static bool consistent(const bool *down) {
+  uint32_t seen = 0;
+  uint8_t count = 0;
+  for (uint8_t v = engine.held_first; v != NO_VOICE && count <= SYNTH_NUM_VOICES;
+       v = engine.voice_next[v], ++count) {
+    if (!engine.gate_voice[v] || (seen & (1u << v))) { return false; }
+    seen |= 1u << v;
+  }
+  for (uint8_t v = engine.free_first; v != NO_VOICE && count <= SYNTH_NUM_VOICES;
+       v = engine.voice_next[v], ++count) {
+    if (engine.gate_voice[v] || (seen & (1u << v))) { return false; }
+    seen |= 1u << v;
+  }
+  if (count != SYNTH_NUM_VOICES) { return false; }
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    uint8_t pitch = engine.pitch_voice[id];
+    if (engine.gate_voice[id] &&
+        (!down[pitch] || engine.voice_of_pitch[pitch] != id)) { return false; }
+  }
+  return true;
+}
+
+static bool run_stream(uint8_t policy, uint32_t events, bool all_off) {
+  static const char *policies[] = { "oldest", "quietest", "same-pitch" };
+  bool down[128] = { false };
+  uint32_t seed = 0x2468ACE1 + policy;
+  synth_init(&engine);
+  synth_set_steal_policy(&engine, policy);
+  bool ok = true;
+  for (uint32_t i = 0; ok && i < events; ++i) {
+    uint32_t r = xorshift32(&seed);
+    // few keys: many repeats, retriggers and steals
+    uint8_t key = 48 + r % (3 * SYNTH_NUM_VOICES);
+    uint8_t id = (r >> 8) % SYNTH_NUM_VOICES;
+    engine.voice[id].eg_level = (r >> 12) & 0xFFFFF; // for the quietest
+    if ((r >> 4) & 1) {
+      apply_note_on(&engine, key);
+      down[key] = true;
+    } else {
+      apply_note_off(&engine, key);
+      down[key] = false;
+    }
+    ok = consistent(down);
+  }
+  if (all_off) {
+    apply_all_notes_off(&engine);
+    memset(down, 0, sizeof(down));
+  } else {
+    for (uint8_t key = 0; key < 128; ++key) {
+      if (down[key]) { apply_note_off(&engine, key); down[key] = false; }
+    }
+  }
+  ok &= consistent(down) && gates() == 0;
+  printf("stream %-10s %-14s %s\n", policies[policy],
+         all_off ? "all notes off" : "note offs", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  uint32_t events = 100000;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      events = strtoul(argv[++i], NULL, 0);
+    } else {
+      fprintf(stderr, "usage: voice_alloc [-n events]\n");
+      return 2;
+    }
+  }
+
+  bool ok = true;
+#if SYNTH_NUM_VOICES == 4
+  for (size_t c = 0; c < sizeof(scripts) / sizeof(scripts[0]); ++c) {
+    ok &= run_script(&scripts[c]);
+  }
+#endif
+  for (uint8_t policy = SYNTH_STEAL_OLDEST; policy <= SYNTH_STEAL_SAME_PITCH;
+       ++policy) {
+    ok &= run_stream(policy, events, false);
+    ok &= run_stream(policy, events, true);
+  }
+  printf("result: %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
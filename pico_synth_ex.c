@@ -12,72 +12,375 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "pico/stdlib.h"
 #include "pico/float.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
 #include "hardware/irq.h"
 #include "hardware/pwm.h"
+#include "hardware/sync.h"
 #include "pico_synth_ex.h"
 #include "pico_synth_ex_presets.h"
+#ifdef SYNTH_TABLES_HEADER
+#include SYNTH_TABLES_HEADER // generated by host/synth_tables
+#else
 #include "pico_synth_ex_tables.h"
+#endif
 #include "sound_i2s.h"
+#if SYNTH_DUAL_CORE
+#include "pico/multicore.h"
+#endif
+#if PICO_ON_DEVICE
+#include "hardware/structs/systick.h"
+#else
+#include <time.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#ifndef SYNTH_BLOCK_SIZE
+#define SYNTH_BLOCK_SIZE 64 // frames rendered per inner loop pass
+#endif
+
+#define SYNTH_STR(x) #x
+#define SYNTH_UNROLL(n) _Pragma(SYNTH_STR(GCC unroll n))
+
+//////// Voice mixer ///////////////////////////////
+// Voices are summed with the same headroom as four voices: beyond four,
+// each voice is scaled down by SYNTH_VOICE_SHIFT before summing, then
+// the sum is normalized by a shift (power of two counts) or a gain.
+#if   SYNTH_NUM_VOICES <= 1
+#define SYNTH_VOICES_LOG2 0
+#elif SYNTH_NUM_VOICES <= 2
+#define SYNTH_VOICES_LOG2 1
+#elif SYNTH_NUM_VOICES <= 4
+#define SYNTH_VOICES_LOG2 2
+#elif SYNTH_NUM_VOICES <= 8
+#define SYNTH_VOICES_LOG2 3
+#elif SYNTH_NUM_VOICES <= 16
+#define SYNTH_VOICES_LOG2 4
+#elif SYNTH_NUM_VOICES <= 32
+#define SYNTH_VOICES_LOG2 5
+#else
+#error "SYNTH_NUM_VOICES must be between 1 and 32"
+#endif
+
+#define SYNTH_VOICE_SHIFT \
+    ((SYNTH_VOICES_LOG2 > 2) ? (SYNTH_VOICES_LOG2 - 2) : 0)
+#define SYNTH_MIX_POWER_OF_2 \
+    ((SYNTH_NUM_VOICES & (SYNTH_NUM_VOICES - 1)) == 0)
+// Q14 gain for counts that are not a power of two
+#define SYNTH_MIX_GAIN \
+    (((1 << 14) << SYNTH_VOICE_SHIFT) / SYNTH_NUM_VOICES)
+
+static inline Q28 normalize_mix(Q28 sum) {
+#if SYNTH_MIX_POWER_OF_2
+  return sum >> (SYNTH_VOICES_LOG2 - SYNTH_VOICE_SHIFT);
+#else
+  return (sum >> 14) * SYNTH_MIX_GAIN;
+#endif
+}
+
+//////// Render parameters /////////////////////////
+// Setting values and table pointers, read once per block
+// instead of once per sample and voice
+typedef struct {
+  Q14 (*wave_tables)[OSC_WAVE_TABLE_SIZE]; // Osc_wave_tables[Osc_waveform]
+  int32_t osc_2_pitch_offset;       // oscillator 2 pitch offset
+  Q14 osc_1_gain;                   // oscillator 1 mix level
+  Q14 osc_2_gain;                   // oscillator 2 mix level
+  int32_t cutoff_base;              // cutoff setting (x4)
+  int8_t cutoff_mod_amount;         // cutoff modulation amount
+  struct FILTER_COEFS *coefs_table; // Filter_coefs_table[Filter_resonance]
+  uint32_t decay_period;            // samples per decay step
+  int32_t sustain_level;            // sustain level (EG level scale)
+  uint32_t lfo_freq;                // LFO phase increment
+  uint8_t lfo_depth;                // LFO depth setting value
+  uint8_t control_shift;            // control period (log2 samples)
+} render_params_t;
+
+static inline Q28 Osc_phase_to_audio(const render_params_t *p,
+                                     uint32_t phase, uint8_t pitch);
+static inline int32_t Osc_clamp_pitch(int32_t full_pitch);
+static inline uint32_t Osc_increment(int32_t full_pitch, uint8_t id);
+static inline Q28 Osc_mix(const render_params_t *p, synth_voice_t *v,
+                          uint8_t pitch_1, uint8_t pitch_2);
+static inline Q28 Osc_process(synth_t *synth, const render_params_t *p,
+                              uint8_t id, uint16_t full_pitch,
+                              Q14 pitch_mod_in);
+static inline int32_t mul_s32_s32_h32(int32_t x, int32_t y);
+static inline int32_t Filter_target_cutoff(const render_params_t *p,
+                                           Q14 cutoff_mod_in);
+static inline Q28 Filter_biquad(synth_voice_t *v,
+                                const struct FILTER_COEFS *coefs_ptr,
+                                Q28 audio_in);
+static inline Q28 Filter_process(synth_t *synth, const render_params_t *p,
+                                 uint8_t id, Q28 audio_in, Q14 cutoff_mod_in);
+static inline Q28 Amp_process(uint8_t id, Q28 audio_in, Q14 gain_in);
+static inline Q14 EG_process(synth_t *synth, const render_params_t *p,
+                             uint8_t id, uint8_t gate_in);
+static inline void EG_advance(synth_voice_t *v, const render_params_t *p,
+                              uint8_t gate_in, uint32_t count);
+static inline Q14 LFO_triangle(const render_params_t *p, uint32_t phase);
+static inline Q14 LFO_process(synth_t *synth, const render_params_t *p,
+                              uint8_t id);
+static inline Q14 LFO_advance(synth_voice_t *v, const render_params_t *p,
+                              uint8_t id, uint32_t count);
+static inline void pan_cut(int8_t position, uint16_t *cut);
+static inline void stereo_image(const synth_t *synth, Q28 *left, Q28 *right);
+static inline void PWMA_process(Q28 left, Q28 right);
+static inline void load_render_params(synth_t *synth, render_params_t *p);
+static inline Q28 process_voice(synth_t *synth, const render_params_t *p,
+                                uint8_t id, uint8_t gate, uint8_t pitch);
+static void render_voice_control_rate(synth_t *synth,
+                                      const render_params_t *p, uint8_t id,
+                                      uint8_t gate, uint8_t pitch,
+                                      Q28 *mix, size_t frames);
+static inline bool voice_is_active(synth_voice_t *v, uint8_t gate);
+static void render_voice_range(synth_t *synth, const render_params_t *p,
+                               Q28 *mix_l, Q28 *mix_r, size_t frames,
+                               uint8_t first, uint8_t last);
+#if !SYNTH_PWM_DMA
+static void pwm_irq_handler();
+#endif
+static void process_events(synth_t *synth, uint32_t now);
+static size_t frames_to_next_event(synth_t *synth, size_t max);
+static void apply_event(synth_t *synth, const synth_event_t *ev);
+static Preset_t *begin_settings_update(synth_t *synth);
+static void publish_settings(synth_t *synth);
+static inline void read_settings(synth_t *synth, Preset_t *out);
+
+//////// Synth state ///////////////////////////////
+// Engine driven by the functions without a synth_t argument, set up
+// before main() (its size grows with SYNTH_NUM_VOICES, so it stays in
+// main RAM rather than next to the core 1 stack in scratch X)
+static synth_t synth;
+
+static void __attribute__((constructor)) init_default_synth() {
+  synth_init(&synth);
+}
+
+// Engines mixed by the audio outputs
+static synth_t *output_synths[SYNTH_MAX_OUTPUTS] = { &synth };
+static uint8_t num_output_synths = 1;
+
+void synth_init(synth_t *synth) {
+  memset(synth, 0, sizeof(synth_t));
+  synth->settings[0] = presets[0];
+  synth->width = 64;
+}
+
+//////// Settings ///////////////////////////////////
+// The settings are double-buffered. A writer fills the inactive copy and
+// publishes it by incrementing settings_version, whose low bit selects
+// the active copy, so the renderer never sees a half-written preset.
+// There must be a single writer context per engine.
+const Preset_t *synth_get_settings(synth_t *synth) {
+  return &synth->settings[synth->settings_version & 1];
+}
+
+static Preset_t *begin_settings_update(synth_t *synth) {
+  uint32_t version = synth->settings_version;
+  Preset_t *next = &synth->settings[(version + 1) & 1];
+  *next = synth->settings[version & 1];
+  return next;
+}
+
+static void publish_settings(synth_t *synth) {
+  __mem_fence_release(); // the copy is complete before the swap
+  synth->settings_version = synth->settings_version + 1;
+}
+
+// Snapshot of the active settings. The copy is retried if a writer
+// published twice meanwhile and may have been writing to it.
+static inline void read_settings(synth_t *synth, Preset_t *out) {
+  uint32_t version;
+  do {
+    version = synth->settings_version;
+    __mem_fence_acquire();
+    *out = synth->settings[version & 1];
+    __mem_fence_acquire();
+  } while (version != synth->settings_version);
+}
+
+synth_t *get_synth_state() {
+  return &synth;
+}
+
+bool set_output_synths(synth_t *const *synths, uint8_t count) {
+  if (count == 0 || count > SYNTH_MAX_OUTPUTS) { return false; }
+  for (uint8_t k = 0; k < count; ++k) { output_synths[k] = synths[k]; }
+  num_output_synths = count;
+  return true;
+}
+
+//////// Output rates //////////////////////////////////
+// The tables hold the values for FCLKSYS and FS. Another sample rate
+// recomputes the ones that depend on it, with the formulas they were
+// made with; the filter cutoffs stop at the same fraction of the rate,
+// and the notes take wave tables with fewer harmonics as the rate drops.
+static uint32_t sys_clock_hz = FCLKSYS;
+static uint32_t sample_rate = FS;
+static uint32_t cycles_per_frame = FCLKSYS / FS; // system clocks per sample
+static uint32_t cycles_per_us_q16 = (uint32_t) (((uint64_t) FCLKSYS << 16) / 1000000);
+// Set once an output renders from interrupts: the rates and the tables
+// they use stay as they were then
+static bool output_started;
+
+// Wave table of each pitch: one table per 4 semitones
+#define WAVE_INDEX_4(k) k, k, k, k
+static uint8_t Osc_wave_index[121] = { 0,
+  WAVE_INDEX_4(1),  WAVE_INDEX_4(2),  WAVE_INDEX_4(3),  WAVE_INDEX_4(4),
+  WAVE_INDEX_4(5),  WAVE_INDEX_4(6),  WAVE_INDEX_4(7),  WAVE_INDEX_4(8),
+  WAVE_INDEX_4(9),  WAVE_INDEX_4(10), WAVE_INDEX_4(11), WAVE_INDEX_4(12),
+  WAVE_INDEX_4(13), WAVE_INDEX_4(14), WAVE_INDEX_4(15), WAVE_INDEX_4(16),
+  WAVE_INDEX_4(17), WAVE_INDEX_4(18), WAVE_INDEX_4(19), WAVE_INDEX_4(20),
+  WAVE_INDEX_4(21), WAVE_INDEX_4(22), WAVE_INDEX_4(23), WAVE_INDEX_4(24),
+  WAVE_INDEX_4(25), WAVE_INDEX_4(26), WAVE_INDEX_4(27), WAVE_INDEX_4(28),
+  WAVE_INDEX_4(29), WAVE_INDEX_4(30),
+};
+
+static void compute_rate_tables(uint32_t rate) {
+  float fs = (float) rate;
+  float ratio = fs / FORMULA_REFERENCE_RATE;
+  for (uint8_t i = 0; i < 122; ++i) { Osc_freq_table[i] = formula_osc_freq(i, fs); }
+  // The wave tables of a pitch an octave up at half the rate
+  uint8_t offset = 0;
+  while (offset < 30 && FS > fs * powf(2.0F, (offset * 4) / 12.0F)) { ++offset; }
+  for (uint8_t pitch = 0; pitch <= 120; ++pitch) {
+    uint8_t index = ((pitch + 3) >> 2) + offset;
+    Osc_wave_index[pitch] = (index < 30) ? index : 30;
+  }
+  for (uint8_t i = 0; i < 65; ++i) {
+    LFO_freq_table[i] = formula_lfo_freq(i, fs);
+    EG_exp_table[i] = formula_eg_period(i, ratio);
+  }
+  float max_f0 = formula_filter_max_f0(ratio);
+  for (uint8_t r = 0; r < 6; ++r) {
+    for (uint16_t c = 0; c <= 480; ++c) {
+      Filter_coefs_table[r][c] = formula_filter_coefs(r, c, fs, max_f0);
+    }
+  }
+}
+
+// The voices run at the sample rate, or at half of it (see the half-rate
+// voices below): the tables follow the rate they run at
+static uint8_t voice_rate_shift;
+static uint32_t table_rate = FS;
+
+// The formulas give back the filter coefficients of FS only to a float
+// rounding, so the tables that a rate change rewrites are saved first, on
+// the heap (programs that keep FS do without), and back at FS the engine
+// plays from them again, as it does from boot
+typedef struct {
+  uint32_t osc_freq[122];
+  uint8_t wave_index[121];
+  uint32_t lfo_freq[65];
+  uint32_t eg_exp[65];
+  struct FILTER_COEFS filter_coefs[6][481];
+} rate_tables_t;
+static rate_tables_t *shipped_rate_tables;
+
+// Tables for the voices at rate; false if the shipped ones cannot be saved
+static bool update_rate_tables(uint32_t rate) {
+  if (rate == table_rate) { return true; }
+  rate_tables_t *t = shipped_rate_tables;
+  if (!t) {
+    if (!(t = malloc(sizeof(rate_tables_t)))) { return false; }
+    memcpy(t->osc_freq, Osc_freq_table, sizeof(t->osc_freq));
+    memcpy(t->wave_index, Osc_wave_index, sizeof(t->wave_index));
+    memcpy(t->lfo_freq, LFO_freq_table, sizeof(t->lfo_freq));
+    memcpy(t->eg_exp, EG_exp_table, sizeof(t->eg_exp));
+    memcpy(t->filter_coefs, Filter_coefs_table, sizeof(t->filter_coefs));
+    shipped_rate_tables = t;
+  }
+  if (rate == FS) {
+    memcpy(Osc_freq_table, t->osc_freq, sizeof(t->osc_freq));
+    memcpy(Osc_wave_index, t->wave_index, sizeof(t->wave_index));
+    memcpy(LFO_freq_table, t->lfo_freq, sizeof(t->lfo_freq));
+    memcpy(EG_exp_table, t->eg_exp, sizeof(t->eg_exp));
+    memcpy(Filter_coefs_table, t->filter_coefs, sizeof(t->filter_coefs));
+  } else {
+    compute_rate_tables(rate);
+  }
+  table_rate = rate;
+  return true;
+}
+
+bool set_output_rates(uint32_t sys_clock, uint32_t rate) {
+  if (rate < SYNTH_MIN_SAMPLE_RATE || rate > SYNTH_MAX_SAMPLE_RATE ||
+      sys_clock < 1000000 || sys_clock / rate < 256 ||
+      sys_clock / rate > 65536 || output_started ||
+      !update_rate_tables(rate >> voice_rate_shift)) { return false; }
+  sys_clock_hz = sys_clock;
+  sample_rate = rate;
+  cycles_per_frame = sys_clock / rate;
+  cycles_per_us_q16 = (uint32_t) (((uint64_t) sys_clock << 16) / 1000000);
+  return true;
+}
+
+uint32_t get_sample_rate() { return sample_rate; }
+
+uint32_t get_sys_clock_hz() { return sys_clock_hz; }
+
 //////// Oscillator group //////////////////////////////
-static volatile uint8_t Osc_waveform = 0; // waveform setting value
-static volatile int8_t Osc_2_coarse_pitch = +0; // oscillator 2 coarse pitch setting value
-static volatile int8_t Osc_2_fine_pitch = +4; // oscillator 2 fine pitch setting value
-static volatile uint8_t Osc_1_2_mix = 16; // oscillator mix setting
-
-static inline Q28 Osc_phase_to_audio(uint32_t phase, uint8_t pitch) {
-  Q14* wave_table = Osc_wave_tables[Osc_waveform][(pitch + 3) >> 2];
-  uint16_t curr_index = phase >> 23;
-  uint16_t next_index = (curr_index + 1) & 0x000001FF;
+static inline Q28 Osc_phase_to_audio(const render_params_t *p,
+                                     uint32_t phase, uint8_t pitch) {
+  Q14* wave_table = p->wave_tables[Osc_wave_index[pitch]];
+  uint32_t curr_index = phase >> (32 - OSC_WAVE_TABLE_BITS);
+  uint32_t next_index = (curr_index + 1) & (OSC_WAVE_TABLE_SIZE - 1);
   Q14 curr_sample = wave_table[curr_index];
   Q14 next_sample = wave_table[next_index];
-  Q14 next_weight = (phase >> 9) & 0x3FFF;
+  Q14 next_weight = (phase >> (32 - OSC_WAVE_TABLE_BITS - 14)) & 0x3FFF;
   return (curr_sample << 14) + ((next_sample - curr_sample) * next_weight);
 }
 
-static inline Q28 Osc_process(uint8_t id,
-                              uint16_t full_pitch, Q14 pitch_mod_in) {
-  static uint32_t phase_1[4]; // Oscillator 1 phase
-  int32_t full_pitch_1 = full_pitch + ((256 * pitch_mod_in) >> 14);
-  full_pitch_1 += (full_pitch_1 < 0)          * (0 - full_pitch_1);
-  full_pitch_1 -= (full_pitch_1 > (120 << 8)) * (full_pitch_1 - (120 << 8));
+static inline int32_t Osc_clamp_pitch(int32_t full_pitch) {
+  full_pitch += (full_pitch < 0)          * (0 - full_pitch);
+  full_pitch -= (full_pitch > (120 << 8)) * (full_pitch - (120 << 8));
+  return full_pitch;
+}
+
+// Phase increment per sample for a clamped pitch
+static inline uint32_t Osc_increment(int32_t full_pitch, uint8_t id) {
+  uint8_t pitch = (full_pitch + 128) >> 8;
+  uint8_t tune  = (full_pitch + 128) & 0xFF;
+  uint32_t freq = Osc_freq_table[pitch];
+  return freq + ((id - 1) << 8) + // Shift by voice
+         (((int32_t) (freq >> 8) * Osc_tune_table[tune]) >> 6);
+}
+
+static inline Q28 Osc_mix(const render_params_t *p, synth_voice_t *v,
+                          uint8_t pitch_1, uint8_t pitch_2) {
+  // TODO: I want to make wave_table switching smoother (Is it better to switch at the beginning of the cycle?)
+  return ((Osc_phase_to_audio(p, v->osc_phase_1, pitch_1) >> 14) *
+                              p->osc_1_gain) +
+         ((Osc_phase_to_audio(p, v->osc_phase_2, pitch_2) >> 14) *
+                              p->osc_2_gain);
+}
+
+static inline Q28 Osc_process(synth_t *synth, const render_params_t *p,
+                              uint8_t id, uint16_t full_pitch,
+                              Q14 pitch_mod_in) {
+  synth_voice_t *v = &synth->voice[id];
+  int32_t full_pitch_1 =
+      Osc_clamp_pitch(full_pitch + ((256 * pitch_mod_in) >> 14));
   uint8_t pitch_1 = (full_pitch_1 + 128) >> 8;
-  uint8_t tune_1  = (full_pitch_1 + 128) & 0xFF;
-  uint32_t freq_1 = Osc_freq_table[pitch_1];
-  phase_1[id] += freq_1 + ((id - 1) << 8); // Shift by voice
-  phase_1[id] += ((int32_t) (freq_1 >> 8) * Osc_tune_table[tune_1]) >> 6;
+  v->osc_phase_1 += Osc_increment(full_pitch_1, id);
 
-  static uint32_t phase_2[4]; // Oscillator 2 phase
   int32_t full_pitch_2 =
-      full_pitch_1 + (Osc_2_coarse_pitch << 8) + (Osc_2_fine_pitch << 2);
-  full_pitch_2 += (full_pitch_2 < 0)          * (0 - full_pitch_2);
-  full_pitch_2 -= (full_pitch_2 > (120 << 8)) * (full_pitch_2 - (120 << 8));
+      Osc_clamp_pitch(full_pitch_1 + p->osc_2_pitch_offset);
   uint8_t pitch_2 = (full_pitch_2 + 128) >> 8;
-  uint8_t tune_2  = (full_pitch_2 + 128) & 0xFF;
-  uint32_t freq_2 = Osc_freq_table[pitch_2];
-  phase_2[id] += freq_2 + ((id - 1) << 8); // Shift by voice
-  phase_2[id] += ((int32_t) (freq_2 >> 8) * Osc_tune_table[tune_2]) >> 6;
+  v->osc_phase_2 += Osc_increment(full_pitch_2, id);
 
-  // TODO: I want to make wave_table switching smoother (Is it better to switch at the beginning of the cycle?)
-  return ((Osc_phase_to_audio(phase_1[id], pitch_1) >> 14) *
-                              Osc_mix_table[Osc_1_2_mix - 0]) +
-         ((Osc_phase_to_audio(phase_2[id], pitch_2) >> 14) *
-                              Osc_mix_table[64 - Osc_1_2_mix]);
+  return Osc_mix(p, v, pitch_1, pitch_2);
 }
 
 //////// filter ///////////////////////////////////
-static volatile uint8_t Filter_cutoff = 60; // Cutoff setting value
-static volatile uint8_t Filter_resonance = 3; // Resonance setting value
-static volatile int8_t Filter_mod_amount = +60; // Cutoff modulation amount setting value
-
 static inline int32_t mul_s32_s32_h32(int32_t x, int32_t y) {
   // Higher 32 bits of signed 32-bit multiplication result
   int32_t x1 = x >> 16; uint32_t x0 = x & 0xFFFF;
@@ -87,24 +390,34 @@ static inline int32_t mul_s32_s32_h32(int32_t x, int32_t y) {
   return (z >> 16) + (x0_y1 >> 16) + (x1 * y1);
 }
 
-static inline Q28 Filter_process(uint8_t id, Q28 audio_in, Q14 cutoff_mod_in) {
-  static uint16_t curr_cutoff[4]; // Cutoff current value
-  int32_t targ_cutoff = Filter_cutoff << 2; // Cutoff target value
-  targ_cutoff += (Filter_mod_amount * cutoff_mod_in) >> (14 - 2);
+static inline int32_t Filter_target_cutoff(const render_params_t *p,
+                                           Q14 cutoff_mod_in) {
+  int32_t targ_cutoff = p->cutoff_base; // Cutoff target value
+  targ_cutoff += (p->cutoff_mod_amount * cutoff_mod_in) >> (14 - 2);
   targ_cutoff += (targ_cutoff < 0)   * (0 - targ_cutoff);
   targ_cutoff -= (targ_cutoff > 480) * (targ_cutoff - 480);
-  curr_cutoff[id] += (curr_cutoff[id] < targ_cutoff);
-  curr_cutoff[id] -= (curr_cutoff[id] > targ_cutoff);
-  struct FILTER_COEFS* coefs_ptr =
-      &Filter_coefs_table[Filter_resonance][curr_cutoff[id]];
+  return targ_cutoff;
+}
+
+static inline Q28 Filter_process(synth_t *synth, const render_params_t *p,
+                                 uint8_t id, Q28 audio_in, Q14 cutoff_mod_in) {
+  synth_voice_t *v = &synth->voice[id];
+  int32_t targ_cutoff = Filter_target_cutoff(p, cutoff_mod_in);
+  v->filter_cutoff += (v->filter_cutoff < targ_cutoff);
+  v->filter_cutoff -= (v->filter_cutoff > targ_cutoff);
+  return Filter_biquad(v, &p->coefs_table[v->filter_cutoff], audio_in);
+}
 
-  static Q28 x1[4], x2[4], y1[4], y2[4];
+static inline Q28 Filter_biquad(synth_voice_t *v,
+                                const struct FILTER_COEFS *coefs_ptr,
+                                Q28 audio_in) {
   Q28 x0 = audio_in;
-  Q28 x3 = x0 + (x1[id] << 1) + x2[id];
-  Q28 y0 = mul_s32_s32_h32(coefs_ptr->b0_a0, x3)     << 4;
-  y0    -= mul_s32_s32_h32(coefs_ptr->a1_a0, y1[id]) << 4;
-  y0    -= mul_s32_s32_h32(coefs_ptr->a2_a0, y2[id]) << 4;
-  x2[id] = x1[id]; y2[id] = y1[id]; x1[id] = x0; y1[id] = y0;
+  Q28 x3 = x0 + (v->filter_x1 << 1) + v->filter_x2;
+  Q28 y0 = mul_s32_s32_h32(coefs_ptr->b0_a0, x3)           << 4;
+  y0    -= mul_s32_s32_h32(coefs_ptr->a1_a0, v->filter_y1) << 4;
+  y0    -= mul_s32_s32_h32(coefs_ptr->a2_a0, v->filter_y2) << 4;
+  v->filter_x2 = v->filter_x1; v->filter_y2 = v->filter_y1;
+  v->filter_x1 = x0;           v->filter_y1 = y0;
   return y0;
 }
 
@@ -116,79 +429,162 @@ static inline Q28 Amp_process(uint8_t id, Q28 audio_in, Q14 gain_in) {
 //////// EG (Envelope Generator) /////////////////
 static uint32_t EG_exp_table[65]; // Exponential table
 
-static volatile uint8_t EG_decay_time = 40; // Decay time setting value
-static volatile uint8_t EG_sustain_level = 0; // Sustain level setting value
+static inline Q14 EG_process(synth_t *synth, const render_params_t *p,
+                             uint8_t id, uint8_t gate_in) {
+  synth_voice_t *v = &synth->voice[id];
+  v->eg_attack_phase |= (v->eg_gate == 0) & gate_in;
+  v->eg_attack_phase &= (v->eg_level < (1 << 24)) & gate_in;
+  v->eg_gate          =  gate_in;
 
-static inline Q14 EG_process(uint8_t id, uint8_t gate_in) {
-  static int32_t curr_level[4]; // EG output level current value
-  static uint8_t curr_gate[4]; // gate input level current value
-  static uint8_t curr_attack_phase[4]; // current attack phase
-
-  curr_attack_phase[id] |= (curr_gate[id] == 0) & gate_in;
-  curr_attack_phase[id] &= (curr_level[id] < (1 << 24)) & gate_in;
-  curr_gate[id]          =  gate_in;
-
-  if (curr_attack_phase[id]) {
+  if (v->eg_attack_phase) {
     int32_t attack_targ_level = (1 << 24) + (1 << 23);
-    curr_level[id] += ((attack_targ_level - curr_level[id]) >> 5);
+    v->eg_level += ((attack_targ_level - v->eg_level) >> 5);
   } else {
-    static uint32_t decay_counter[4]; // Decay counter
-    ++decay_counter[id];
-    decay_counter[id] =
-        (decay_counter[id] < EG_exp_table[EG_decay_time]) * decay_counter[id];
-    int32_t decay_targ_level = (EG_sustain_level << 18) * curr_gate[id];
-    int32_t to_decay = (curr_level[id] > decay_targ_level) &
-                       (decay_counter[id] == 0);
-    curr_level[id] += to_decay *
-                      ((decay_targ_level - curr_level[id]) >> 5);
+    ++v->eg_decay_counter;
+    v->eg_decay_counter =
+        (v->eg_decay_counter < p->decay_period) * v->eg_decay_counter;
+    int32_t decay_targ_level = p->sustain_level * v->eg_gate;
+    int32_t to_decay = (v->eg_level > decay_targ_level) &
+                       (v->eg_decay_counter == 0);
+    v->eg_level += to_decay * ((decay_targ_level - v->eg_level) >> 5);
   }
 
-  return curr_level[id] >> 10;
+  return v->eg_level >> 10;
+}
+
+// 1 - (31/32)^n in Q16: n steps of the EG at once
+static uint16_t EG_steps_coefs[SYNTH_MAX_CONTROL_PERIOD + 1];
+
+static void EG_init_steps_coefs() {
+  uint32_t remaining = 1 << 16;
+  for (uint8_t n = 0; n <= SYNTH_MAX_CONTROL_PERIOD; ++n) {
+    EG_steps_coefs[n] = (1 << 16) - remaining;
+    remaining -= remaining >> 5;
+  }
+}
+
+// EG_process() over count samples, at the control rate
+static inline void EG_advance(synth_voice_t *v, const render_params_t *p,
+                              uint8_t gate_in, uint32_t count) {
+  v->eg_attack_phase |= (v->eg_gate == 0) & gate_in;
+  v->eg_attack_phase &= (v->eg_level < (1 << 24)) & gate_in;
+  v->eg_gate          =  gate_in;
+
+  // The attack runs step by step, as in EG_process(): it is short, and
+  // the decay starts from the level its last step overshoots 1.0 to
+  if (v->eg_attack_phase) {
+    int32_t attack_targ_level = (1 << 24) + (1 << 23);
+    for (; count > 0 && v->eg_level < (1 << 24); --count) {
+      v->eg_level += ((attack_targ_level - v->eg_level) >> 5);
+    }
+    if (count == 0) { return; }
+    v->eg_attack_phase = 0; // ended within the period
+  }
+  uint32_t counter = v->eg_decay_counter + count;
+  uint32_t steps = counter / p->decay_period;
+  v->eg_decay_counter = counter % p->decay_period;
+  int32_t targ_level = p->sustain_level * v->eg_gate;
+  steps *= (v->eg_level > targ_level);
+  v->eg_level += ((int64_t) (targ_level - v->eg_level) *
+                  EG_steps_coefs[steps]) >> 16;
 }
 
 //////// Low Frequency Oscillator (LFO) /////////
-static volatile uint8_t LFO_depth = 16; // Depth setting value
-static volatile uint8_t LFO_rate = 48; // Speed ​​setting value
+static inline Q14 LFO_process(synth_t *synth, const render_params_t *p,
+                              uint8_t id) {
+  synth_voice_t *v = &synth->voice[id];
+  v->lfo_phase += p->lfo_freq + ((id - 1) << 8); // Shift by voice
+  return LFO_triangle(p, v->lfo_phase);
+}
 
-static inline Q14 LFO_process(uint8_t id) {
-  static uint32_t phase[4]; // Phase
-  phase[id] += LFO_freq_table[LFO_rate] + ((id - 1) << 8); // Shift by voice
+// LFO_process() over count samples, at the control rate
+static inline Q14 LFO_advance(synth_voice_t *v, const render_params_t *p,
+                              uint8_t id, uint32_t count) {
+  v->lfo_phase += (p->lfo_freq + ((id - 1) << 8)) * count;
+  return LFO_triangle(p, v->lfo_phase);
+}
 
+static inline Q14 LFO_triangle(const render_params_t *p, uint32_t phase) {
   // Generate triangle wave
-  uint16_t phase_h16 = phase[id] >> 16;
+  uint16_t phase_h16 = phase >> 16;
   uint16_t out = phase_h16;
   out += (phase_h16 >= 32768) * (65536 - (phase_h16 << 1));
-  return ((out - 16384) * LFO_depth) >> 7;
+  return ((out - 16384) * p->lfo_depth) >> 7;
+}
+
+//////// Stereo image ////////////////////////////
+// A pan only takes gain off the far channel, along the constant-power
+// curve of Osc_mix_table scaled to unity at the centre: a centred engine
+// renders exactly as a mono one. Gains are kept as cuts so that a
+// zero-initialized engine is centred.
+static inline void pan_cut(int8_t position, uint16_t *cut) {
+  uint8_t index = position + 32;
+  int32_t left  = Osc_mix_table[index] * ONE_Q14 / Osc_mix_table[32];
+  int32_t right = Osc_mix_table[64 - index] * ONE_Q14 / Osc_mix_table[32];
+  cut[0] = (left  < ONE_Q14) * (ONE_Q14 - left);
+  cut[1] = (right < ONE_Q14) * (ONE_Q14 - right);
+}
+
+// Add a voice, rendered on its own, to the stereo mix at its place
+static inline void pan_voice(const uint16_t *cut, const Q28 *voice,
+                             Q28 *mix_l, Q28 *mix_r, size_t frames) {
+  int32_t gain_l = ONE_Q14 - cut[0];
+  int32_t gain_r = ONE_Q14 - cut[1];
+  for (size_t i = 0; i < frames; ++i) {
+    int32_t audio = voice[i] >> 14;
+    mix_l[i] += audio * gain_l;
+    mix_r[i] += audio * gain_r;
+  }
+}
+
+// Width of the spread voices, then the pan of the engine, on one frame
+static inline void stereo_image(const synth_t *synth, Q28 *left, Q28 *right) {
+  if (synth->spread && synth->width != 64) {
+    Q28 mid  = (*left >> 1) + (*right >> 1);
+    Q28 side = ((*left - *right) >> 7) * synth->width;
+    *left  = mid + side;
+    *right = mid - side;
+  }
+  if (synth->pan) {
+    *left  = (*left >> 14)  * (ONE_Q14 - synth->pan_cut[0]);
+    *right = (*right >> 14) * (ONE_Q14 - synth->pan_cut[1]);
+  }
 }
 
 //////// I2S Audio output ////////////
-bool i2s_timer_callback(repeating_timer_t *timer) {
-  static int16_t *last_buffer;
-  int16_t *buffer = sound_i2s_get_next_buffer();
-  if (buffer == NULL) return true;
-  if (buffer != last_buffer) {
-    last_buffer = buffer;
-    Q28 voice_out[4];
-    for (int i = 0; i < SOUND_I2S_BUFFER_NUM_SAMPLES; i++) {
-      voice_out[0] = process_voice(0);
-      voice_out[1] = process_voice(1);
-      voice_out[2] = process_voice(2);
-      voice_out[3] = process_voice(3);
-      Q28 mix = ((voice_out[0] + voice_out[1] +
-                        voice_out[2] + voice_out[3]) >> 2);
-      uint16_t level = (mix >> 14);
-
-      // Copy to I2S buffer
-      *buffer++ = level;
-      *buffer++ = level;
-    }
+// Renders every buffer of the ring that has played (see
+// sound_i2s_get_stats() for the underruns when they are not in time)
+static void i2s_render_free_buffers(void) {
+  int16_t *buffer;
+  while ((buffer = sound_i2s_begin_render()) != NULL) {
+    synth_render(output_synths, num_output_synths,
+                 buffer, sound_i2s_get_buffer_frames());
+    sound_i2s_end_render(buffer);
   }
+}
+
+bool i2s_timer_callback(repeating_timer_t *timer) {
+  output_started = true;
+  i2s_render_free_buffers();
   return true;
 }
 
+// A buffer is rendered as soon as it has played, a whole ring ahead of
+// its turn, whatever the period of a timer would have been
+void start_i2s_dma_rendering() {
+  output_started = true;
+  sound_i2s_set_refill_callback(i2s_render_free_buffers);
+  // The refill interrupt may come in meanwhile: it finds the buffer in
+  // the works and leaves the rest to this loop
+  i2s_render_free_buffers();
+}
+
+void stop_i2s_dma_rendering() {
+  sound_i2s_set_refill_callback(NULL);
+}
+
 
 //////// PWM audio output block ///////////////////////
-static bool use_pwm;
 int8_t PWMA_R_GPIO = -1;
 int8_t PWMA_L_GPIO = -1;
 static int8_t PWMA_R_SLICE;
@@ -196,10 +592,17 @@ static int8_t PWMA_L_SLICE;
 static int8_t PWMA_R_CHAN;
 static int8_t PWMA_L_CHAN;
 
-#define PWMA_CYCLE (FCLKSYS / FS) // PWM cycle
+#define PWMA_CYCLE (cycles_per_frame) // PWM cycle
+
+#if SYNTH_PWM_DMA
+static void pwm_dma_start();
+#endif
 
 void PWMA_init(int8_t pwm_gpio_r, int8_t pwm_gpio_l) {
-  use_pwm = true;
+#if !SYNTH_PWM_DMA
+  set_half_rate_voices(false); // one frame per interrupt
+#endif
+  output_started = true;
   PWMA_R_GPIO = pwm_gpio_r;
   PWMA_L_GPIO = pwm_gpio_l;
   if(PWMA_R_GPIO > -1) PWMA_R_SLICE = pwm_gpio_to_slice_num(PWMA_R_GPIO);
@@ -208,9 +611,13 @@ void PWMA_init(int8_t pwm_gpio_r, int8_t pwm_gpio_l) {
   if(PWMA_L_GPIO > -1) PWMA_L_CHAN = pwm_gpio_to_channel(PWMA_L_GPIO);
   if(PWMA_R_GPIO > -1) gpio_set_function(PWMA_R_GPIO, GPIO_FUNC_PWM);
   if(PWMA_L_GPIO > -1) gpio_set_function(PWMA_L_GPIO, GPIO_FUNC_PWM);
+#if SYNTH_PWM_DMA
+  pwm_dma_start(); // Left channel must be active
+#else
   irq_set_exclusive_handler(PWM_IRQ_WRAP, pwm_irq_handler);
   irq_set_enabled(PWM_IRQ_WRAP, true);
   pwm_set_irq_enabled(PWMA_L_SLICE, true); // Left channel must be active
+#endif
   if(PWMA_R_GPIO > -1) pwm_set_wrap(PWMA_R_SLICE, PWMA_CYCLE - 1);
   if(PWMA_L_GPIO > -1) pwm_set_wrap(PWMA_L_SLICE, PWMA_CYCLE - 1);
   if(PWMA_R_GPIO > -1) pwm_set_chan_level(PWMA_R_SLICE, PWMA_R_CHAN, PWMA_CYCLE / 2);
@@ -219,201 +626,1076 @@ void PWMA_init(int8_t pwm_gpio_r, int8_t pwm_gpio_l) {
   if(PWMA_L_GPIO > -1) pwm_set_enabled(PWMA_L_SLICE, true);
 }
 
-static inline void PWMA_process(Q28 audio_in) {
-  int32_t level_int32 = (audio_in >> 18) + (PWMA_CYCLE / 2);
-  uint16_t level = (level_int32 > 0) * level_int32;
-  if(PWMA_R_GPIO > -1) pwm_set_chan_level(PWMA_R_SLICE, PWMA_R_CHAN, level);
-  if(PWMA_L_GPIO > -1) pwm_set_chan_level(PWMA_L_SLICE, PWMA_L_CHAN, level);
+// Noise shaping: the 4 bits that a 16-bit sample loses to the level are
+// fed back into the next samples, once (NTF 1 - z^-1) or twice
+// (NTF (1 - z^-1)^2), which moves the requantization noise towards FS/2.
+// The errors stay within 0..15 whatever the signal, so it cannot run away.
+static uint8_t pwm_shaping_order;
+static int32_t pwm_shaping_error[2][2]; // [left, right][n - 1, n - 2]
+
+bool set_pwm_noise_shaping(uint8_t order) {
+  if (order > 2) { return false; }
+  pwm_shaping_order = order;
+  for (uint8_t c = 0; c < 2; ++c) {
+    pwm_shaping_error[c][0] = pwm_shaping_error[c][1] = 0;
+  }
+  return true;
+}
+
+// The level keeps the top 12 bits of a 16-bit sample; order 0 truncates
+static inline uint16_t PWMA_level(int32_t sample, uint8_t channel) {
+  int32_t *error = pwm_shaping_error[channel];
+  int32_t shaped = sample + pwm_shaping_order * error[0] -
+                   (pwm_shaping_order >> 1) * error[1];
+  int32_t level_int32 = shaped >> 4;
+  error[1] = error[0];
+  error[0] = shaped - (level_int32 << 4);
+  level_int32 += PWMA_CYCLE / 2;
+  return (level_int32 > 0) * level_int32;
+}
+
+static inline void PWMA_process(Q28 left, Q28 right) {
+  // A mono setup plays both channels on the left output
+  if(PWMA_R_GPIO < 0) left = (left >> 1) + (right >> 1);
+  if(PWMA_R_GPIO > -1) pwm_set_chan_level(PWMA_R_SLICE, PWMA_R_CHAN, PWMA_level(right >> 14, 1));
+  if(PWMA_L_GPIO > -1) pwm_set_chan_level(PWMA_L_SLICE, PWMA_L_CHAN, PWMA_level(left >> 14, 0));
 }
 
+#if SYNTH_PWM_DMA
+// Blocks are rendered by synth_render() and turned into compare register
+// words, which the DMA writes on every wrap of the slice. Each slice has
+// two channels chained to each other, one per buffer, so the hardware
+// goes on to the other buffer by itself when one ends. The interrupt that
+// ends a buffer only points its channel back to the start and renders it
+// again, and has the whole of the other buffer to do so: one interrupt
+// per block instead of one per sample. Output 0 is the left slice, output
+// 1 the right one when the pins are on two slices.
+static uint32_t pwm_buffer[2][2][SYNTH_PWM_BLOCK_FRAMES]; // [output][buffer]
+static int8_t pwm_dma_chan[2][2] = { { -1, -1 }, { -1, -1 } }; // [output][buffer]
+static uint8_t pwm_played[2]; // outputs done with each buffer, as a mask
+static uint8_t pwm_outputs;   // mask of the outputs
+
+static void pwm_render_buffer(uint8_t b) {
+  uint32_t *words = pwm_buffer[0][b];
+  uint32_t *right_words = pwm_buffer[1][b];
+  uint8_t shift_l = PWMA_L_CHAN * 16;
+  uint8_t shift_r = PWMA_R_CHAN * 16;
+  synth_render(output_synths, num_output_synths, (int16_t *) words,
+               SYNTH_PWM_BLOCK_FRAMES);
+  for (size_t i = 0; i < SYNTH_PWM_BLOCK_FRAMES; ++i) {
+    int16_t left = words[i] >> 16;
+    int16_t right = words[i];
+    if (PWMA_R_GPIO < 0) { // mono: both channels on the left output
+      words[i] = (uint32_t) PWMA_level((left >> 1) + (right >> 1), 0) << shift_l;
+    } else if (pwm_dma_chan[1][0] < 0) { // both pins on one slice
+      words[i] = ((uint32_t) PWMA_level(left, 0) << shift_l) |
+                 ((uint32_t) PWMA_level(right, 1) << shift_r);
+    } else {
+      words[i] = (uint32_t) PWMA_level(left, 0) << shift_l;
+      right_words[i] = (uint32_t) PWMA_level(right, 1) << shift_r;
+    }
+  }
+}
+
+static void __isr pwm_dma_handler() {
+  for (uint8_t b = 0; b < 2; ++b) {
+    for (uint8_t o = 0; o < 2; ++o) {
+      int8_t chan = pwm_dma_chan[o][b];
+      if (chan >= 0 && dma_channel_get_irq1_status(chan)) {
+        dma_channel_acknowledge_irq1(chan);
+        // Ready for the chain trigger, once the other buffer ends
+        dma_channel_set_read_addr(chan, pwm_buffer[o][b], false);
+        pwm_played[b] |= 1 << o;
+      }
+    }
+    // With two slices, the buffer is rendered once both have played it
+    if (pwm_played[b] == pwm_outputs) {
+      pwm_played[b] = 0;
+      pwm_render_buffer(b);
+    }
+  }
+}
+
+// Buffer 0 plays silence while buffer 1 holds the first block
+static void pwm_dma_start() {
+  uint8_t slices[2] = { PWMA_L_SLICE, PWMA_R_SLICE };
+  bool two_slices = PWMA_R_GPIO > -1 && PWMA_R_SLICE != PWMA_L_SLICE;
+  pwm_outputs = two_slices ? 3 : 1;
+  for (uint8_t o = 0; o < 1 + two_slices; ++o) {
+    pwm_dma_chan[o][0] = dma_claim_unused_channel(true);
+    pwm_dma_chan[o][1] = dma_claim_unused_channel(true);
+  }
+  uint32_t silence = PWMA_CYCLE / 2;
+  for (size_t i = 0; i < SYNTH_PWM_BLOCK_FRAMES; ++i) {
+    pwm_buffer[0][0][i] = (silence << (PWMA_L_CHAN * 16)) |
+                          ((PWMA_R_GPIO > -1 && !two_slices) *
+                           silence << (PWMA_R_CHAN * 16));
+    pwm_buffer[1][0][i] = silence << (PWMA_R_CHAN * 16);
+  }
+  pwm_played[0] = pwm_played[1] = 0;
+  pwm_render_buffer(1);
+
+  irq_set_exclusive_handler(DMA_IRQ_1, pwm_dma_handler);
+  irq_set_priority(DMA_IRQ_1, PICO_LOWEST_IRQ_PRIORITY);
+  irq_set_enabled(DMA_IRQ_1, true);
+  uint32_t start_mask = 0;
+  for (uint8_t o = 0; o < 1 + two_slices; ++o) {
+    for (uint8_t b = 0; b < 2; ++b) {
+      uint chan = pwm_dma_chan[o][b];
+      dma_channel_config c = dma_channel_get_default_config(chan);
+      channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+      channel_config_set_read_increment(&c, true);
+      channel_config_set_write_increment(&c, false);
+      channel_config_set_dreq(&c, pwm_get_dreq(slices[o]));
+      channel_config_set_chain_to(&c, pwm_dma_chan[o][b ^ 1]);
+      dma_channel_set_irq1_enabled(chan, true);
+      dma_channel_configure(chan, &c, &pwm_hw->slice[slices[o]].cc,
+                            pwm_buffer[o][b], SYNTH_PWM_BLOCK_FRAMES, false);
+    }
+    start_mask |= 1u << pwm_dma_chan[o][0];
+  }
+  dma_start_channel_mask(start_mask); // the slices start together
+}
+#endif
+
 //////// Interrupt handler and main functions ////////////
 static volatile uint16_t start_time = 0; // start time
 static volatile uint16_t max_start_time = 0; // max start time
-static volatile uint16_t proc_time = 0; // processing time
-static volatile uint16_t max_proc_time = 0; // maximum processing time
-
-static volatile uint8_t gate_voice[4]; // gate control value (per voice)
-static volatile uint8_t pitch_voice[4]; // pitch control value (per voice)
-static volatile int8_t Octave_shift; // key octave shift amount
-
-static inline Q28 process_voice(uint8_t id) {
-  Q14 lfo_out    = LFO_process(id);
-  Q14 eg_out     = EG_process(id, gate_voice[id]);
-  Q28 osc_out    = Osc_process(id, pitch_voice[id] << 8, lfo_out);
-  Q28 filter_out = Filter_process(id, osc_out, eg_out);
+
+//////// Load measurement ////////////////////////
+static synth_load_t output_load;
+static uint32_t average_cycles_q4; // moving averages, 4 fractional bits
+static uint32_t average_load_q4;
+
+// Free-running cycle counter: the 24-bit SysTick down counter on the
+// device (started on first use), the monotonic clock scaled to the
+// system clock on the host. Differences are taken modulo LOAD_CLOCK_MASK + 1.
+// A SysTick that the application (or an RTOS) already runs with a shorter
+// period does not count freely: the microsecond timer, scaled to the
+// system clock in Q16 (clocks that are not whole MHz included), stands in
+// for it. It wraps with time_us_32(), once every 71 minutes.
+#if PICO_ON_DEVICE
+#define LOAD_CLOCK_MASK 0x00FFFFFF
+static inline uint32_t load_clock() {
+  if (!(systick_hw->csr & 1)) {
+    systick_hw->rvr = LOAD_CLOCK_MASK;
+    systick_hw->csr = 0x5; // enabled, processor clock, no interrupt
+  }
+  if (systick_hw->rvr != LOAD_CLOCK_MASK) {
+    return (uint32_t) (((uint64_t) time_us_32() * cycles_per_us_q16) >> 16);
+  }
+  return LOAD_CLOCK_MASK - systick_hw->cvr;
+}
+#else
+#define LOAD_CLOCK_MASK 0xFFFFFFFF
+static inline uint32_t load_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ((uint64_t) ts.tv_sec * sys_clock_hz +
+                     (uint64_t) ts.tv_nsec * sys_clock_hz / 1000000000u);
+}
+#endif
+
+static void load_update(uint32_t start, size_t frames) {
+  synth_load_t *l = &output_load;
+  uint32_t cycles = (load_clock() - start) & LOAD_CLOCK_MASK;
+  uint32_t deadline = frames * cycles_per_frame;
+  uint32_t load = (cycles < UINT32_MAX / 10000) ?
+                  cycles * 10000 / deadline : // no 64-bit division per sample
+                  (uint64_t) cycles * 10000 / deadline;
+  if (load > UINT16_MAX) { load = UINT16_MAX; }
+  if (l->blocks == 0) {
+    average_cycles_q4 = cycles << 4;
+    average_load_q4 = load << 4;
+  }
+  average_cycles_q4 += cycles - (average_cycles_q4 >> 4);
+  average_load_q4 += load - (average_load_q4 >> 4);
+  ++l->blocks;
+  l->cycles = cycles;
+  l->average_cycles = average_cycles_q4 >> 4;
+  l->peak_cycles += (cycles > l->peak_cycles) * (cycles - l->peak_cycles);
+  l->load = load;
+  l->average_load = average_load_q4 >> 4;
+  l->peak_load += (load > l->peak_load) * (load - l->peak_load);
+  uint32_t bin = load / 1000;
+  ++l->histogram[(bin < SYNTH_LOAD_BINS - 1) ? bin : SYNTH_LOAD_BINS - 1];
+}
+
+void get_output_load(synth_load_t *load) { *load = output_load; }
+
+void reset_output_load() {
+  memset(&output_load, 0, sizeof(output_load));
+}
+
+static inline void load_render_params(synth_t *synth, render_params_t *p) {
+  Preset_t snapshot;
+  read_settings(synth, &snapshot);
+  const Preset_t *settings = &snapshot;
+  uint8_t mix           = settings->Osc_1_2_mix;
+  p->wave_tables        = Osc_wave_tables[settings->Osc_waveform];
+  p->osc_2_pitch_offset = (settings->Osc_2_coarse_pitch << 8) +
+                          (settings->Osc_2_fine_pitch << 2);
+  p->osc_1_gain         = Osc_mix_table[mix - 0];
+  p->osc_2_gain         = Osc_mix_table[64 - mix];
+  p->cutoff_base        = settings->Filter_cutoff << 2;
+  p->cutoff_mod_amount  = settings->Filter_mod_amount;
+  p->coefs_table        = Filter_coefs_table[settings->Filter_resonance];
+  p->decay_period       = EG_exp_table[settings->EG_decay_time];
+  p->sustain_level      = settings->EG_sustain_level << 18;
+  p->lfo_freq           = LFO_freq_table[settings->LFO_rate];
+  p->lfo_depth          = settings->LFO_depth;
+  p->control_shift      = synth->control_shift;
+}
+
+static inline Q28 process_voice(synth_t *synth, const render_params_t *p,
+                                uint8_t id, uint8_t gate, uint8_t pitch) {
+  Q14 lfo_out    = LFO_process(synth, p, id);
+  Q14 eg_out     = EG_process(synth, p, id, gate);
+  Q28 osc_out    = Osc_process(synth, p, id, pitch << 8, lfo_out);
+  Q28 filter_out = Filter_process(synth, p, id, osc_out, eg_out);
   Q28 amp_out    = Amp_process(id, filter_out, eg_out);
   return amp_out;
 }
 
+// process_voice() with the EG, the LFO and the filter cutoff evaluated
+// once per control period. Within a period the amp gain and the
+// oscillator phase increments ramp linearly towards their values at its
+// end, and the filter coefficients stay fixed.
+static void render_voice_control_rate(synth_t *synth,
+                                      const render_params_t *p, uint8_t id,
+                                      uint8_t gate, uint8_t pitch,
+                                      Q28 *mix, size_t frames) {
+  synth_voice_t *v = &synth->voice[id];
+  size_t period = (size_t) 1 << p->control_shift;
+  for (size_t start = 0; start < frames; start += period) {
+    size_t count = (frames - start < period) ? frames - start : period;
+
+    // Modulators at the end of the period
+    int32_t eg_level = v->eg_level;
+    EG_advance(v, p, gate, count);
+    Q14 lfo_out = LFO_advance(v, p, id, count);
+
+    int32_t full_pitch_1 =
+        Osc_clamp_pitch((pitch << 8) + ((256 * lfo_out) >> 14));
+    int32_t full_pitch_2 =
+        Osc_clamp_pitch(full_pitch_1 + p->osc_2_pitch_offset);
+    uint8_t pitch_1 = (full_pitch_1 + 128) >> 8;
+    uint8_t pitch_2 = (full_pitch_2 + 128) >> 8;
+    uint32_t targ_inc_1 = Osc_increment(full_pitch_1, id);
+    uint32_t targ_inc_2 = Osc_increment(full_pitch_2, id);
+    if (pitch != v->osc_pitch || v->osc_inc_1 == 0) { // new note: no ramp
+      v->osc_inc_1 = targ_inc_1; v->osc_inc_2 = targ_inc_2;
+      v->osc_pitch = pitch;
+    }
+
+    // The cutoff moves at most one step per sample, as in Filter_process()
+    int32_t max_step = count;
+    int32_t cutoff_step =
+        Filter_target_cutoff(p, v->eg_level >> 10) - v->filter_cutoff;
+    cutoff_step += (cutoff_step < -max_step) * (-max_step - cutoff_step);
+    cutoff_step -= (cutoff_step > max_step)  * (cutoff_step - max_step);
+    v->filter_cutoff += cutoff_step;
+    const struct FILTER_COEFS *coefs_ptr = &p->coefs_table[v->filter_cutoff];
+
+    // Linear ramps (a division only for a short last period)
+    int32_t eg_step = v->eg_level - eg_level;
+    int32_t inc_step_1 = (int32_t) (targ_inc_1 - v->osc_inc_1);
+    int32_t inc_step_2 = (int32_t) (targ_inc_2 - v->osc_inc_2);
+    if (count == period) {
+      eg_step >>= p->control_shift;
+      inc_step_1 >>= p->control_shift;
+      inc_step_2 >>= p->control_shift;
+    } else {
+      eg_step /= (int32_t) count;
+      inc_step_1 /= (int32_t) count;
+      inc_step_2 /= (int32_t) count;
+    }
+    uint32_t inc_1 = v->osc_inc_1;
+    uint32_t inc_2 = v->osc_inc_2;
+
+    for (size_t i = start; i < start + count; ++i) {
+      inc_1 += inc_step_1; v->osc_phase_1 += inc_1;
+      inc_2 += inc_step_2; v->osc_phase_2 += inc_2;
+      eg_level += eg_step;
+      Q28 osc_out    = Osc_mix(p, v, pitch_1, pitch_2);
+      Q28 filter_out = Filter_biquad(v, coefs_ptr, osc_out);
+      Q28 amp_out    = Amp_process(id, filter_out, eg_level >> 10);
+      mix[i] += amp_out >> SYNTH_VOICE_SHIFT;
+    }
+    v->osc_inc_1 = targ_inc_1;
+    v->osc_inc_2 = targ_inc_2;
+  }
+}
+
+static void render_voice(synth_t *synth, const render_params_t *p,
+                         uint8_t id, uint8_t gate, uint8_t pitch,
+                         Q28 *mix, size_t frames) {
+  for (size_t i = 0; i < frames; ++i) {
+    mix[i] += process_voice(synth, p, id, gate, pitch) >> SYNTH_VOICE_SHIFT;
+  }
+}
+
+// Activity tracking: once its gate is off and its EG has fallen below
+// SYNTH_IDLE_LEVEL, a voice is idle and all its stages are skipped. The
+// next gate on brings it back with the filter at rest and the oscillators
+// at phase 0, so that a note starts the same however long the voice idled.
+static inline bool voice_is_active(synth_voice_t *v, uint8_t gate) {
+  if (gate) {
+    if (!v->active) {
+      v->osc_phase_1 = 0; v->osc_phase_2 = 0;
+      v->filter_x1 = 0; v->filter_x2 = 0;
+      v->filter_y1 = 0; v->filter_y2 = 0;
+      v->active = 1;
+    }
+  } else if (v->active && v->eg_level < SYNTH_IDLE_LEVEL) {
+    v->eg_level = 0; v->eg_gate = 0; v->eg_attack_phase = 0;
+    v->active = 0;
+  }
+  return v->active;
+}
+
+// Sum voices first..last-1 of one engine into mix_l and mix_r, or into
+// mix_l alone when the engine does not spread its voices. Gate and pitch
+// are read once per call and each active voice runs in its own tight
+// loop; a spread voice is then panned into place.
+static void render_voice_range(synth_t *synth, const render_params_t *p,
+                               Q28 *mix_l, Q28 *mix_r, size_t frames,
+                               uint8_t first, uint8_t last) {
+  Q28 voice_mix[SYNTH_BLOCK_SIZE];
+  bool spread = synth->spread;
+  memset(mix_l, 0, frames * sizeof(Q28));
+  if (spread) { memset(mix_r, 0, frames * sizeof(Q28)); }
+  for (uint8_t id = first; id < last; ++id) {
+    uint8_t gate = synth->gate_voice[id];
+    uint8_t pitch = synth->pitch_voice[id];
+    if (!voice_is_active(&synth->voice[id], gate)) { continue; }
+    Q28 *mix = mix_l;
+    if (spread) {
+      mix = voice_mix;
+      memset(voice_mix, 0, frames * sizeof(Q28));
+    }
+    if (p->control_shift) {
+      render_voice_control_rate(synth, p, id, gate, pitch, mix, frames);
+    } else {
+      render_voice(synth, p, id, gate, pitch, mix, frames);
+    }
+    if (spread) {
+      pan_voice(synth->voice_pan_cut[id], voice_mix, mix_l, mix_r, frames);
+    }
+  }
+}
+
+// Add the voice mix of an engine to the bus, through its stereo image.
+// A mono bus (bus_r NULL) only takes centred, unspread engines.
+static void mix_engine(const synth_t *synth, const Q28 *mix_l,
+                       const Q28 *mix_r, Q28 *bus_l, Q28 *bus_r,
+                       size_t frames) {
+  if (!bus_r) {
+    for (size_t i = 0; i < frames; ++i) { bus_l[i] += normalize_mix(mix_l[i]); }
+    return;
+  }
+  if (!synth->spread) { mix_r = mix_l; }
+  bool image = (synth->spread && synth->width != 64) || synth->pan;
+  for (size_t i = 0; i < frames; ++i) {
+    Q28 left  = normalize_mix(mix_l[i]);
+    Q28 right = normalize_mix(mix_r[i]);
+    if (image) { stereo_image(synth, &left, &right); }
+    bus_l[i] += left;
+    bus_r[i] += right;
+  }
+}
+
+// Add all the voices of the engines to the mix bus
+static void render_engines(synth_t *const *synths, uint8_t num_synths,
+                           const render_params_t *params,
+                           Q28 *bus_l, Q28 *bus_r, size_t frames) {
+  Q28 mix_l[SYNTH_BLOCK_SIZE];
+  Q28 mix_r[SYNTH_BLOCK_SIZE];
+  for (uint8_t k = 0; k < num_synths; ++k) {
+    render_voice_range(synths[k], &params[k], mix_l, mix_r, frames,
+                       0, SYNTH_NUM_VOICES);
+    mix_engine(synths[k], mix_l, mix_r, bus_l, bus_r, frames);
+  }
+}
+
+//////// Dual-core rendering ///////////////////////
+#if SYNTH_DUAL_CORE
+#define SYNTH_CORE1_FIRST_VOICE (SYNTH_NUM_VOICES / 2)
+
+// Chunk handed to core 1, which renders the upper half of the voices of
+// every engine into its own partial buffers. The inter-core FIFO carries
+// the start and done signals.
+static struct {
+  synth_t *const *synths;
+  uint8_t num_synths;
+  const render_params_t *params;
+  size_t frames;
+  Q28 mix_l[SYNTH_MAX_OUTPUTS][SYNTH_BLOCK_SIZE];
+  Q28 mix_r[SYNTH_MAX_OUTPUTS][SYNTH_BLOCK_SIZE];
+} core1_job;
+static Q28 core0_mix_l[SYNTH_MAX_OUTPUTS][SYNTH_BLOCK_SIZE];
+static Q28 core0_mix_r[SYNTH_MAX_OUTPUTS][SYNTH_BLOCK_SIZE];
+static volatile bool core1_running;
+
+static void core1_entry() {
+  while (true) {
+    multicore_fifo_pop_blocking(); // wait for a chunk
+    for (uint8_t k = 0; k < core1_job.num_synths; ++k) {
+      render_voice_range(core1_job.synths[k], &core1_job.params[k],
+                         core1_job.mix_l[k], core1_job.mix_r[k],
+                         core1_job.frames,
+                         SYNTH_CORE1_FIRST_VOICE, SYNTH_NUM_VOICES);
+    }
+    multicore_fifo_push_blocking(0); // chunk done
+  }
+}
+
+static void render_engines_dual_core(synth_t *const *synths,
+                                     uint8_t num_synths,
+                                     const render_params_t *params,
+                                     Q28 *bus_l, Q28 *bus_r, size_t frames) {
+  core1_job.synths = synths;
+  core1_job.num_synths = num_synths;
+  core1_job.params = params;
+  core1_job.frames = frames;
+  multicore_fifo_push_blocking(0); // start core 1
+
+  for (uint8_t k = 0; k < num_synths; ++k) {
+    render_voice_range(synths[k], &params[k], core0_mix_l[k],
+                       core0_mix_r[k], frames, 0, SYNTH_CORE1_FIRST_VOICE);
+  }
+
+  multicore_fifo_pop_blocking(); // wait for core 1
+  for (uint8_t k = 0; k < num_synths; ++k) {
+    for (size_t i = 0; i < frames; ++i) {
+      core0_mix_l[k][i] += core1_job.mix_l[k][i];
+    }
+    if (synths[k]->spread) {
+      for (size_t i = 0; i < frames; ++i) {
+        core0_mix_r[k][i] += core1_job.mix_r[k][i];
+      }
+    }
+    mix_engine(synths[k], core0_mix_l[k], core0_mix_r[k], bus_l, bus_r,
+               frames);
+  }
+}
+
+void start_dual_core_rendering() {
+  if (core1_running) { return; }
+  multicore_launch_core1(core1_entry);
+  core1_running = true;
+}
+
+void stop_dual_core_rendering() {
+  if (!core1_running) { return; }
+  core1_running = false;
+  multicore_reset_core1();
+}
+#endif
+
+//////// Half-rate voices ////////////////////////
+// The voices can run at half the sample rate, for patches with nothing
+// to play above a quarter of it: the tables are set for the lower rate,
+// the bus is mixed at it and a half-band FIR doubles its rate. Of each
+// pair of output frames the first is a bus sample and the second is
+// interpolated between it and the next by the odd phase of the filter,
+// 8 symmetric coefficient pairs (31 taps, Kaiser window, beta 4.5): flat
+// within 0.04 dB up to 9 kHz at 44.1 kHz and 47 dB down from 13 kHz.
+// The output is HALF_BAND_TAPS - 1 bus samples late.
+#define HALF_BAND_TAPS 8
+#define HALF_BAND_HISTORY (2 * HALF_BAND_TAPS - 1)
+
+static const Q14 half_band_coefs[HALF_BAND_TAPS] = {
+  10371, -3248, 1715, -1005, 591, -330, 166, -68, // sum 8192: unity at DC
+};
+
+// Bus of the last chunk after the history it needs, [left, right]
+static Q28 half_rate_bus[2][HALF_BAND_HISTORY + SYNTH_BLOCK_SIZE];
+static uint32_t half_rate_pending; // frame kept for the next render
+static bool half_rate_has_pending;
+
+bool set_half_rate_voices(bool enabled) {
+  // The interrupts render from the bus and the tables: no change once an
+  // output runs (the per-sample PWM interrupt always runs at full rate)
+  if (output_started) { return enabled == voice_rate_shift; }
+  if (!update_rate_tables(sample_rate >> enabled)) { return false; }
+  voice_rate_shift = enabled;
+  memset(half_rate_bus, 0, sizeof(half_rate_bus));
+  half_rate_has_pending = false;
+  return true;
+}
+
+bool get_half_rate_voices() { return voice_rate_shift; }
+
+static inline Q28 half_band_odd(const Q28 *x) {
+  Q28 sum = 0;
+  SYNTH_UNROLL(HALF_BAND_TAPS)
+  for (uint8_t j = 0; j < HALF_BAND_TAPS; ++j) {
+    sum += ((x[-j] >> 14) + (x[1 + j] >> 14)) * half_band_coefs[j];
+  }
+  return sum;
+}
+
+// Write the 2n frames of the n bus samples that follow the history, as
+// far as room goes (the one left over waits for the next render), and
+// keep the last samples as the new history. A mono bus keeps the left
+// history on both channels, ready for a stereo chunk.
+static uint32_t *half_band_upsample(uint32_t *frame, size_t n, bool stereo,
+                                    size_t room) {
+  Q28 *bus_l = half_rate_bus[0];
+  Q28 *bus_r = half_rate_bus[1];
+  for (size_t i = 0; i < n; ++i) {
+    const Q28 *x_l = bus_l + i + HALF_BAND_TAPS - 1;
+    const Q28 *x_r = stereo ? bus_r + i + HALF_BAND_TAPS - 1 : x_l;
+    Q28 odd_l = half_band_odd(x_l);
+    Q28 odd_r = stereo ? half_band_odd(x_r) : odd_l;
+    uint32_t even = ((uint32_t) (uint16_t) (x_l[0] >> 14) << 16) |
+                    (uint16_t) (x_r[0] >> 14);
+    uint32_t odd = ((uint32_t) (uint16_t) (odd_l >> 14) << 16) |
+                   (uint16_t) (odd_r >> 14);
+    *frame++ = even;
+    if (2 * i + 1 < room) {
+      *frame++ = odd;
+    } else {
+      half_rate_pending = odd;
+      half_rate_has_pending = true;
+    }
+  }
+  memmove(bus_l, bus_l + n, HALF_BAND_HISTORY * sizeof(Q28));
+  memcpy(bus_r, stereo ? bus_r + n : bus_l, HALF_BAND_HISTORY * sizeof(Q28));
+  return frame;
+}
+
+void synth_render(synth_t *const *synths, uint8_t num_synths,
+                  int16_t *out, size_t frames) {
+  if (num_synths > SYNTH_MAX_OUTPUTS) { num_synths = SYNTH_MAX_OUTPUTS; }
+  // Q14 gain of the engine mix: one divide per call, not per sample
+  Q14 mix_gain = (num_synths > 1) ? (1 << 14) / num_synths : (1 << 14);
+  uint32_t load_start = load_clock();
+  size_t block_frames = frames;
+  uint8_t shift = voice_rate_shift;
+  render_params_t params[SYNTH_MAX_OUTPUTS];
+  Q28 block_l[SYNTH_BLOCK_SIZE];
+  Q28 block_r[SYNTH_BLOCK_SIZE];
+  Q28 *bus_l = shift ? half_rate_bus[0] + HALF_BAND_HISTORY : block_l;
+  Q28 *bus_r = shift ? half_rate_bus[1] + HALF_BAND_HISTORY : block_r;
+  uint32_t *frame = (uint32_t *) out; // one store per frame
+  if (half_rate_has_pending && frames > 0) {
+    *frame++ = half_rate_pending;
+    half_rate_has_pending = false;
+    --frames;
+  }
+  while (frames > 0) {
+    // Chunks end at the next event, so that it starts on its own frame
+    // (or on the next one, for an odd frame at half rate). n counts the
+    // frames of the voices, each of which makes 1 << shift output frames.
+    size_t round = ((size_t) 1 << shift) - 1;
+    size_t n = (frames + round) >> shift;
+    n = (n < SYNTH_BLOCK_SIZE) ? n : SYNTH_BLOCK_SIZE;
+    for (uint8_t k = 0; k < num_synths; ++k) {
+      process_events(synths[k], synths[k]->frame_count);
+      n = (frames_to_next_event(synths[k], n << shift) + round) >> shift;
+    }
+    // The bus stays mono while every engine is centred and unspread
+    bool stereo = false;
+    for (uint8_t k = 0; k < num_synths; ++k) {
+      load_render_params(synths[k], &params[k]);
+      stereo |= synths[k]->spread || synths[k]->pan;
+    }
+    Q28 *right = stereo ? bus_r : NULL;
+    memset(bus_l, 0, n * sizeof(Q28));
+    if (stereo) { memset(bus_r, 0, n * sizeof(Q28)); }
+#if SYNTH_DUAL_CORE
+    if (core1_running) {
+      render_engines_dual_core(synths, num_synths, params, bus_l, right, n);
+    } else {
+      render_engines(synths, num_synths, params, bus_l, right, n);
+    }
+#else
+    render_engines(synths, num_synths, params, bus_l, right, n);
+#endif
+    for (uint8_t k = 0; k < num_synths; ++k) {
+      synths[k]->frame_count = synths[k]->frame_count + (n << shift);
+    }
+    if (num_synths > 1) {
+      for (size_t i = 0; i < n; ++i) { bus_l[i] = (bus_l[i] >> 14) * mix_gain; }
+      if (stereo) {
+        for (size_t i = 0; i < n; ++i) { bus_r[i] = (bus_r[i] >> 14) * mix_gain; }
+      }
+    }
+    if (shift) {
+      frame = half_band_upsample(frame, n, stereo, frames);
+      frames -= (2 * n < frames) ? 2 * n : frames;
+      continue;
+    }
+    if (stereo) {
+      for (size_t i = 0; i < n; ++i) {
+        *frame++ = ((uint32_t) (uint16_t) (bus_l[i] >> 14) << 16) |
+                   (uint16_t) (bus_r[i] >> 14);
+      }
+    } else {
+      for (size_t i = 0; i < n; ++i) {
+        *frame++ = (uint16_t) (bus_l[i] >> 14) * 0x00010001u;
+      }
+    }
+    frames -= n;
+  }
+  if (block_frames > 0) { load_update(load_start, block_frames); }
+}
+
+void synth_render_block(int16_t *out, size_t frames) {
+  synth_t *synths[1] = { &synth };
+  synth_render(synths, 1, out, frames);
+}
+
+#if !SYNTH_PWM_DMA
 static void pwm_irq_handler() {
+  uint32_t load_start = load_clock();
   pwm_clear_irq(PWMA_L_SLICE);
   start_time = pwm_get_counter(PWMA_L_SLICE);
 
-  Q28 voice_out[4];
-  voice_out[0] = process_voice(0);
-  voice_out[1] = process_voice(1);
-  voice_out[2] = process_voice(2);
-  voice_out[3] = process_voice(3);
-  PWMA_process((voice_out[0] + voice_out[1] +
-                voice_out[2] + voice_out[3]) >> 2);
+  Q28 mix_l = 0, mix_r = 0;
+  for (uint8_t k = 0; k < num_output_synths; ++k) {
+    synth_t *s = output_synths[k];
+    render_params_t params;
+    process_events(s, s->frame_count);
+    load_render_params(s, &params);
+    s->frame_count = s->frame_count + 1;
+    Q28 sum_l = 0, sum_r = 0;
+    SYNTH_UNROLL(SYNTH_NUM_VOICES)
+    for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+      uint8_t gate = s->gate_voice[id];
+      if (!voice_is_active(&s->voice[id], gate)) { continue; }
+      Q28 voice_out = process_voice(s, &params, id, gate,
+                                    s->pitch_voice[id]) >> SYNTH_VOICE_SHIFT;
+      if (s->spread) {
+        const uint16_t *cut = s->voice_pan_cut[id];
+        sum_l += (voice_out >> 14) * (ONE_Q14 - cut[0]);
+        sum_r += (voice_out >> 14) * (ONE_Q14 - cut[1]);
+      } else {
+        sum_l += voice_out;
+      }
+    }
+    Q28 left = normalize_mix(sum_l);
+    Q28 right = s->spread ? normalize_mix(sum_r) : left;
+    stereo_image(s, &left, &right);
+    mix_l += left;
+    mix_r += right;
+  }
+  if (num_output_synths > 1) {
+    mix_l /= num_output_synths;
+    mix_r /= num_output_synths;
+  }
+  PWMA_process(mix_l, mix_r);
 
-  uint16_t end_time = pwm_get_counter(PWMA_L_SLICE);
-  proc_time = end_time - start_time; // simplify calculation
   max_start_time +=
       (start_time > max_start_time) * (start_time - max_start_time);
-  max_proc_time +=
-      (proc_time > max_proc_time) * (proc_time - max_proc_time);
+  load_update(load_start, 1);
+}
+#endif
+
+//////// Voice allocation (renderer side) //////////
+// Every voice is on one of two lists: the held voices in note-on order
+// (oldest first) and the released ones in release order (longest
+// released first, so the quietest tail is reused first). voice_of_pitch
+// maps a pitch to the voice that last played it, so note-on and
+// note-off need no scan; only the quietest-voice policy scans when it
+// has to steal.
+#define NO_VOICE 0xFF
+
+static void voice_list_remove(synth_t *synth, uint8_t id,
+                              uint8_t *first, uint8_t *last) {
+  uint8_t prev = synth->voice_prev[id], next = synth->voice_next[id];
+  if (prev == NO_VOICE) { *first = next; } else { synth->voice_next[prev] = next; }
+  if (next == NO_VOICE) { *last = prev; } else { synth->voice_prev[next] = prev; }
+}
+
+static void voice_list_append(synth_t *synth, uint8_t id,
+                              uint8_t *first, uint8_t *last) {
+  synth->voice_prev[id] = *last;
+  synth->voice_next[id] = NO_VOICE;
+  if (*last == NO_VOICE) { *first = id; } else { synth->voice_next[*last] = id; }
+  *last = id;
 }
 
-void note_toggle(uint8_t key) {
-  uint8_t pitch = key + (Octave_shift * 12);
-  if      (pitch_voice[0] == pitch) { gate_voice[0] = (gate_voice[0] == 0); }
-  else if (pitch_voice[1] == pitch) { gate_voice[1] = (gate_voice[1] == 0); }
-  else if (pitch_voice[2] == pitch) { gate_voice[2] = (gate_voice[2] == 0); }
-  else if (pitch_voice[3] == pitch) { gate_voice[3] = (gate_voice[3] == 0); }
-  else if (gate_voice[0] == 0) { pitch_voice[0] = pitch; gate_voice[0] = 1; }
-  else if (gate_voice[1] == 0) { pitch_voice[1] = pitch; gate_voice[1] = 1; }
-  else if (gate_voice[2] == 0) { pitch_voice[2] = pitch; gate_voice[2] = 1; }
-  else                         { pitch_voice[3] = pitch; gate_voice[3] = 1; }
+static void init_voice_allocator(synth_t *synth) {
+  memset(synth->voice_of_pitch, NO_VOICE, sizeof(synth->voice_of_pitch));
+  synth->held_first = synth->held_last = NO_VOICE;
+  synth->free_first = synth->free_last = NO_VOICE;
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    if (synth->gate_voice[id]) {
+      voice_list_append(synth, id, &synth->held_first, &synth->held_last);
+      synth->voice_of_pitch[synth->pitch_voice[id]] = id;
+    } else {
+      voice_list_append(synth, id, &synth->free_first, &synth->free_last);
+    }
+  }
+  synth->allocator_ready = 1;
 }
 
-void note_on(uint8_t key) {
-  uint8_t pitch = key + (Octave_shift * 12);
-  static uint8_t current_voice;
+static uint8_t steal_voice(synth_t *synth) {
+  uint8_t id = synth->held_first; // oldest
+  if (synth->steal_policy == SYNTH_STEAL_QUIETEST) {
+    for (uint8_t v = synth->voice_next[id]; v != NO_VOICE;
+         v = synth->voice_next[v]) {
+      if (synth->voice[v].eg_level < synth->voice[id].eg_level) { id = v; }
+    }
+  }
+  ++synth->steal_count;
+  return id;
+}
 
-  pitch_voice[current_voice] = pitch;
-  gate_voice[current_voice] = 1;
-  current_voice = (++current_voice % 4);
+static uint8_t note_pitch(synth_t *synth, uint8_t key) {
+  return key + (synth_get_settings(synth)->Octave_shift * 12);
 }
 
-void note_off(uint8_t key) {
-  uint8_t pitch = key + (Octave_shift * 12);
-  for (uint8_t id = 0; id < 4; ++id) {
-    if (pitch_voice[id] == pitch) { gate_voice[id] = 0; }
+static void start_voice(synth_t *synth, uint8_t pitch) {
+  if (!synth->allocator_ready) { init_voice_allocator(synth); }
+  uint8_t id = synth->voice_of_pitch[pitch];
+  bool reuse = (id != NO_VOICE) && (synth->gate_voice[id] ||
+                                    synth->steal_policy == SYNTH_STEAL_SAME_PITCH);
+  if (reuse && synth->gate_voice[id]) {
+    voice_list_remove(synth, id, &synth->held_first, &synth->held_last);
+  } else if (reuse) {
+    voice_list_remove(synth, id, &synth->free_first, &synth->free_last);
+  } else if (synth->free_first != NO_VOICE) {
+    id = synth->free_first;
+    voice_list_remove(synth, id, &synth->free_first, &synth->free_last);
+  } else {
+    id = steal_voice(synth);
+    voice_list_remove(synth, id, &synth->held_first, &synth->held_last);
+  }
+  if (synth->gate_voice[id]) {
+    synth->voice[id].eg_gate = 0; // retrigger the attack
+  }
+  if (synth->voice_of_pitch[synth->pitch_voice[id]] == id) {
+    synth->voice_of_pitch[synth->pitch_voice[id]] = NO_VOICE;
+  }
+  synth->pitch_voice[id] = pitch;
+  synth->gate_voice[id] = 1;
+  synth->voice_of_pitch[pitch] = id;
+  voice_list_append(synth, id, &synth->held_first, &synth->held_last);
+}
+
+static void release_voice(synth_t *synth, uint8_t id) {
+  synth->gate_voice[id] = 0;
+  voice_list_remove(synth, id, &synth->held_first, &synth->held_last);
+  voice_list_append(synth, id, &synth->free_first, &synth->free_last);
+}
+
+//////// Event handlers (renderer side) //////////
+static void apply_note_toggle(synth_t *synth, uint8_t key) {
+  uint8_t pitch = note_pitch(synth, key);
+  if (!synth->allocator_ready) { init_voice_allocator(synth); }
+  uint8_t id = synth->voice_of_pitch[pitch];
+  if (id != NO_VOICE && synth->gate_voice[id]) {
+    release_voice(synth, id);
+  } else {
+    start_voice(synth, pitch);
   }
 }
 
-void all_notes_off() {
-  for (uint8_t id = 0; id < 4; ++id) { gate_voice[id] = 0; }
+static void apply_note_on(synth_t *synth, uint8_t key) {
+  start_voice(synth, note_pitch(synth, key));
 }
 
-void startup_chord() {
-  for (uint8_t id = 0; id < 4; ++id) { pitch_voice[id] = 60; }
-  note_on(60); note_on(64); note_on(67); note_on(71);
+static void apply_note_off(synth_t *synth, uint8_t key) {
+  uint8_t pitch = note_pitch(synth, key);
+  if (!synth->allocator_ready) { init_voice_allocator(synth); }
+  uint8_t id = synth->voice_of_pitch[pitch];
+  if (id != NO_VOICE && synth->gate_voice[id]) { release_voice(synth, id); }
 }
 
-int8_t get_octave_shift() {
-  return Octave_shift;
+static void apply_all_notes_off(synth_t *synth) {
+  if (!synth->allocator_ready) { init_voice_allocator(synth); }
+  while (synth->held_first != NO_VOICE) {
+    release_voice(synth, synth->held_first);
+  }
 }
 
-static void load_factory_preset(uint8_t preset) {
-  Octave_shift       = presets[preset].Octave_shift;
-  Osc_waveform       = presets[preset].Osc_waveform;
-  Filter_cutoff      = presets[preset].Filter_cutoff;
-  Filter_resonance   = presets[preset].Filter_resonance;
-  Filter_mod_amount  = presets[preset].Filter_mod_amount;
-  EG_decay_time      = presets[preset].EG_decay_time;
-  EG_sustain_level   = presets[preset].EG_sustain_level;
-  Osc_2_coarse_pitch = presets[preset].Osc_2_coarse_pitch;
-  Osc_2_fine_pitch   = presets[preset].Osc_2_fine_pitch;
-  Osc_1_2_mix        = presets[preset].Osc_1_2_mix;
-  LFO_depth          = presets[preset].LFO_depth;
-  LFO_rate           = presets[preset].LFO_rate;
+static void apply_load_preset(synth_t *synth, const Preset_t *preset) {
+  *begin_settings_update(synth) = *preset;
+  publish_settings(synth);
 }
 
-void load_preset(Preset_t preset) {
-  Octave_shift       = preset.Octave_shift;
-  Osc_waveform       = preset.Osc_waveform;
-  Filter_cutoff      = preset.Filter_cutoff;
-  Filter_resonance   = preset.Filter_resonance;
-  Filter_mod_amount  = preset.Filter_mod_amount;
-  EG_decay_time      = preset.EG_decay_time;
-  EG_sustain_level   = preset.EG_sustain_level;
-  Osc_2_coarse_pitch = preset.Osc_2_coarse_pitch;
-  Osc_2_fine_pitch   = preset.Osc_2_fine_pitch;
-  Osc_1_2_mix        = preset.Osc_1_2_mix;
-  LFO_depth          = preset.LFO_depth;
-  LFO_rate           = preset.LFO_rate;
+static void apply_control_period(synth_t *synth, uint8_t shift) {
+  if (EG_steps_coefs[1] == 0) { EG_init_steps_coefs(); }
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    synth->voice[id].osc_inc_1 = 0; // restart the increment ramps
+  }
+  synth->control_shift = shift;
+}
+
+// The renderer reads the image between events only, so one chunk never
+// sees two of them
+static void apply_stereo(synth_t *synth, int8_t pan, uint8_t spread,
+                         uint8_t width) {
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    int32_t position = (SYNTH_NUM_VOICES > 1) ?
+        spread * (2 * id - (SYNTH_NUM_VOICES - 1)) / (SYNTH_NUM_VOICES - 1) : 0;
+    pan_cut(position, synth->voice_pan_cut[id]);
+  }
+  pan_cut(pan, synth->pan_cut);
+  synth->width = width;
+  synth->pan = pan;
+  synth->spread = spread;
 }
 
-void control_message(control_message_t message) {
+static void apply_control_message(synth_t *synth, control_message_t message) {
+  Preset_t *p = begin_settings_update(synth);
   switch(message){
-    case OCTAVE_SHIFT_DEC:        if (Octave_shift       > -5)  { --Octave_shift;       } break;
-    case OCTAVE_SHIFT_INC:        if (Octave_shift       < +4)  { ++Octave_shift;       } break;
-    case FILTER_CUTOFF_DEC:       if (Filter_cutoff      > 0)   { --Filter_cutoff;      } break;
-    case FILTER_CUTOFF_INC:       if (Filter_cutoff      < 120) { ++Filter_cutoff;      } break;
-    case FILTER_RESONANCE_DEC:    if (Filter_resonance   > 0)   { --Filter_resonance;   } break;
-    case FILTER_RESONANCE_INC:    if (Filter_resonance   < 5)   { ++Filter_resonance;   } break;
-    case FILTER_MOD_AMOUNT_DEC:   if (Filter_mod_amount  > +0)  { --Filter_mod_amount;  } break;
-    case FILTER_MOD_AMOUNT_INC:   if (Filter_mod_amount  < +60) { ++Filter_mod_amount;  } break;
-    case EG_DECAY_TIME_DEC:       if (EG_decay_time      > 0)   { --EG_decay_time;      } break;
-    case EG_DECAY_TIME_INC:       if (EG_decay_time      < 64)  { ++EG_decay_time;      } break;
-    case EG_SUSTAIN_LEVEL_DEC:    if (EG_sustain_level   > 0)   { --EG_sustain_level;   } break;
-    case EG_SUSTAIN_LEVEL_INC:    if (EG_sustain_level   < 64)  { ++EG_sustain_level;   } break;
-    case OSC_WAVEFORM_DEC:        if (Osc_waveform       > 0)   { --Osc_waveform;       } break;
-    case OSC_WAVEFORM_INC:        if (Osc_waveform       < 1)   { ++Osc_waveform;       } break;
-    case OSC_2_COARSE_PITCH_DEC:  if (Osc_2_coarse_pitch > +0)  { --Osc_2_coarse_pitch; } break;
-    case OSC_2_COARSE_PITCH_INC:  if (Osc_2_coarse_pitch < +24) { ++Osc_2_coarse_pitch; } break;
-    case OSC_2_FINE_PITCH_DEC:    if (Osc_2_fine_pitch   > +0)  { --Osc_2_fine_pitch;   } break;
-    case OSC_2_FINE_PITCH_INC:    if (Osc_2_fine_pitch   < +32) { ++Osc_2_fine_pitch;   } break;
-    case OSC_1_2_MIX_DEC:         if (Osc_1_2_mix        > 0)   { --Osc_1_2_mix;        } break;
-    case OSC_1_2_MIX_INC:         if (Osc_1_2_mix        < 64)  { ++Osc_1_2_mix;        } break;
-    case LFO_DEPTH_DEC:           if (LFO_depth          > 0)   { --LFO_depth;          } break;
-    case LFO_DEPTH_INC:           if (LFO_depth          < 64)  { ++LFO_depth;          } break;
-    case LFO_RATE_DEC:            if (LFO_rate           > 0)   { --LFO_rate;           } break;
-    case LFO_RATE_INC:            if (LFO_rate           < 64)  { ++LFO_rate;           } break;
-    case PRESET_0:                                      load_factory_preset(0);           break;
-    case PRESET_1:                                      load_factory_preset(1);           break;
-    case PRESET_2:                                      load_factory_preset(2);           break;
-    case PRESET_3:                                      load_factory_preset(3);           break;
-    case PRESET_4:                                      load_factory_preset(4);           break;
-    case PRESET_5:                                      load_factory_preset(5);           break;
-    case PRESET_6:                                      load_factory_preset(6);           break;
-    case PRESET_7:                                      load_factory_preset(7);           break;
-    case PRESET_8:                                      load_factory_preset(8);           break;
-    case PRESET_9:                                      load_factory_preset(9);           break;
-    case ALL_NOTES_OFF:                                 all_notes_off();                  break;
-  }
-}
-
-void set_parameter(synth_parameter_t parameter, int8_t value){
+    case OCTAVE_SHIFT_DEC:        if (p->Octave_shift       > -5)  { --p->Octave_shift;       } break;
+    case OCTAVE_SHIFT_INC:        if (p->Octave_shift       < +4)  { ++p->Octave_shift;       } break;
+    case FILTER_CUTOFF_DEC:       if (p->Filter_cutoff      > 0)   { --p->Filter_cutoff;      } break;
+    case FILTER_CUTOFF_INC:       if (p->Filter_cutoff      < 120) { ++p->Filter_cutoff;      } break;
+    case FILTER_RESONANCE_DEC:    if (p->Filter_resonance   > 0)   { --p->Filter_resonance;   } break;
+    case FILTER_RESONANCE_INC:    if (p->Filter_resonance   < 5)   { ++p->Filter_resonance;   } break;
+    case FILTER_MOD_AMOUNT_DEC:   if (p->Filter_mod_amount  > +0)  { --p->Filter_mod_amount;  } break;
+    case FILTER_MOD_AMOUNT_INC:   if (p->Filter_mod_amount  < +60) { ++p->Filter_mod_amount;  } break;
+    case EG_DECAY_TIME_DEC:       if (p->EG_decay_time      > 0)   { --p->EG_decay_time;      } break;
+    case EG_DECAY_TIME_INC:       if (p->EG_decay_time      < 64)  { ++p->EG_decay_time;      } break;
+    case EG_SUSTAIN_LEVEL_DEC:    if (p->EG_sustain_level   > 0)   { --p->EG_sustain_level;   } break;
+    case EG_SUSTAIN_LEVEL_INC:    if (p->EG_sustain_level   < 64)  { ++p->EG_sustain_level;   } break;
+    case OSC_WAVEFORM_DEC:        if (p->Osc_waveform       > 0)   { --p->Osc_waveform;       } break;
+    case OSC_WAVEFORM_INC:        if (p->Osc_waveform       < 1)   { ++p->Osc_waveform;       } break;
+    case OSC_2_COARSE_PITCH_DEC:  if (p->Osc_2_coarse_pitch > +0)  { --p->Osc_2_coarse_pitch; } break;
+    case OSC_2_COARSE_PITCH_INC:  if (p->Osc_2_coarse_pitch < +24) { ++p->Osc_2_coarse_pitch; } break;
+    case OSC_2_FINE_PITCH_DEC:    if (p->Osc_2_fine_pitch   > +0)  { --p->Osc_2_fine_pitch;   } break;
+    case OSC_2_FINE_PITCH_INC:    if (p->Osc_2_fine_pitch   < +32) { ++p->Osc_2_fine_pitch;   } break;
+    case OSC_1_2_MIX_DEC:         if (p->Osc_1_2_mix        > 0)   { --p->Osc_1_2_mix;        } break;
+    case OSC_1_2_MIX_INC:         if (p->Osc_1_2_mix        < 64)  { ++p->Osc_1_2_mix;        } break;
+    case LFO_DEPTH_DEC:           if (p->LFO_depth          > 0)   { --p->LFO_depth;          } break;
+    case LFO_DEPTH_INC:           if (p->LFO_depth          < 64)  { ++p->LFO_depth;          } break;
+    case LFO_RATE_DEC:            if (p->LFO_rate           > 0)   { --p->LFO_rate;           } break;
+    case LFO_RATE_INC:            if (p->LFO_rate           < 64)  { ++p->LFO_rate;           } break;
+    case PRESET_0:                                         *p = presets[0];                      break;
+    case PRESET_1:                                         *p = presets[1];                      break;
+    case PRESET_2:                                         *p = presets[2];                      break;
+    case PRESET_3:                                         *p = presets[3];                      break;
+    case PRESET_4:                                         *p = presets[4];                      break;
+    case PRESET_5:                                         *p = presets[5];                      break;
+    case PRESET_6:                                         *p = presets[6];                      break;
+    case PRESET_7:                                         *p = presets[7];                      break;
+    case PRESET_8:                                         *p = presets[8];                      break;
+    case PRESET_9:                                         *p = presets[9];                      break;
+    case ALL_NOTES_OFF:                                    apply_all_notes_off(synth);           break;
+  }
+  publish_settings(synth);
+}
+
+static void apply_set_parameter(synth_t *synth, synth_parameter_t parameter, int8_t value){
+  Preset_t *p = begin_settings_update(synth);
   switch(parameter){
-    case OCTAVE_SHIFT:       if (value >= -5 && value <= +4)  { Octave_shift = value;       } break;    
-    case OSC_WAVEFORM:       if (value >=  0 && value <= 1)   { Osc_waveform = value;       } break;
-    case OSC_2_COARSE_PITCH: if (value >=  0 && value <= 24)  { Osc_2_coarse_pitch = value; } break;
-    case OSC_2_FINE_PITCH:   if (value >=  0 && value <= 32)  { Osc_2_fine_pitch = value;   } break;
-    case OSC_1_2_MIX:        if (value >=  0 && value <= 64)  { Osc_1_2_mix = value;        } break;
-    case EG_SUSTAIN_LEVEL:   if (value >=  0 && value <= 64)  { EG_sustain_level = value;   } break;
-    case EG_DECAY_TIME:      if (value >=  0 && value <= 64)  { EG_decay_time = value;      } break;
-    case FILTER_CUTOFF:      if (value >=  0 && value <= 120) { Filter_cutoff = value;      } break;
-    case FILTER_RESONANCE:   if (value >=  0 && value <= 5)   { Filter_resonance = value;   } break;
-    case FILTER_MOD_AMOUNT:  if (value >=  0 && value <= 60)  { Filter_mod_amount = value;  } break;
-    case LFO_DEPTH:          if (value >=  0 && value <= 64)  { LFO_depth = value;          } break;
-    case LFO_RATE:           if (value >=  0 && value <= 64)  { LFO_rate = value;           } break;
-  }
-}
-
-void print_status(){
-  printf("Pitch             : [ %3hhu, %3hhu, %3hhu, %3hhu ]\n",
-      pitch_voice[0], pitch_voice[1], pitch_voice[2], pitch_voice[3]);
-  printf("Gate              : [ %3hhu, %3hhu, %3hhu, %3hhu ]\n",
-      gate_voice[0], gate_voice[1], gate_voice[2], gate_voice[3]);
-  printf("Octave Shift      : %+3hd\n",       Octave_shift);
-  printf("Osc Waveform      : %3hhu\n",       Osc_waveform);
-  printf("Osc 2 Coarse Pitch: %+3hd\n",       Osc_2_coarse_pitch);
-  printf("Osc 2 Fine Pitch  : %+3hd\n",       Osc_2_fine_pitch);
-  printf("Osc 1/2 Mix       : %3hhu\n",       Osc_1_2_mix);
-  printf("Filter Cutoff     : %3hhu\n",       Filter_cutoff);
-  printf("Filter Resonance  : %3hhu\n",       Filter_resonance);
-  printf("Filter EG Amount  : %+3hd\n",       Filter_mod_amount);
-  printf("EG Decay Time     : %3hhu\n",       EG_decay_time);
-  printf("EG Sustain Level  : %3hhu\n",       EG_sustain_level);
-  printf("LFO Depth         : %3hhu\n",       LFO_depth);
-  printf("LFO Rate          : %3hhu\n",       LFO_rate);
+    case OCTAVE_SHIFT:       if (value >= -5 && value <= +4)  { p->Octave_shift = value;       } break;
+    case OSC_WAVEFORM:       if (value >=  0 && value <= 1)   { p->Osc_waveform = value;       } break;
+    case OSC_2_COARSE_PITCH: if (value >=  0 && value <= 24)  { p->Osc_2_coarse_pitch = value; } break;
+    case OSC_2_FINE_PITCH:   if (value >=  0 && value <= 32)  { p->Osc_2_fine_pitch = value;   } break;
+    case OSC_1_2_MIX:        if (value >=  0 && value <= 64)  { p->Osc_1_2_mix = value;        } break;
+    case EG_SUSTAIN_LEVEL:   if (value >=  0 && value <= 64)  { p->EG_sustain_level = value;   } break;
+    case EG_DECAY_TIME:      if (value >=  0 && value <= 64)  { p->EG_decay_time = value;      } break;
+    case FILTER_CUTOFF:      if (value >=  0 && value <= 120) { p->Filter_cutoff = value;      } break;
+    case FILTER_RESONANCE:   if (value >=  0 && value <= 5)   { p->Filter_resonance = value;   } break;
+    case FILTER_MOD_AMOUNT:  if (value >=  0 && value <= 60)  { p->Filter_mod_amount = value;  } break;
+    case LFO_DEPTH:          if (value >=  0 && value <= 64)  { p->LFO_depth = value;          } break;
+    case LFO_RATE:           if (value >=  0 && value <= 64)  { p->LFO_rate = value;           } break;
+  }
+  publish_settings(synth);
+}
+
+//////// Events //////////////////////////////////
+bool synth_post_event(synth_t *synth, const synth_event_t *event) {
+  synth_event_queue_t *q = &synth->events;
+  uint32_t head = q->head;
+  uint32_t depth = head - q->tail;
+  if (depth >= SYNTH_EVENT_QUEUE_SIZE) { ++q->dropped; return false; }
+  __mem_fence_acquire(); // the renderer is done with the slot
+  q->event[head & (SYNTH_EVENT_QUEUE_SIZE - 1)] = *event;
+  ++depth;
+  q->max_depth += (depth > q->max_depth) * (depth - q->max_depth);
+  __mem_fence_release(); // the event is complete before it is visible
+  q->head = head + 1;
+  return true;
+}
+
+static void post_event(synth_t *synth, synth_event_t event) {
+  event.time = synth->frame_count; // due now
+  synth_post_event(synth, &event);
+}
+
+// Renderer side: apply the events due at frame `now` or earlier, in order
+static void process_events(synth_t *synth, uint32_t now) {
+  synth_event_queue_t *q = &synth->events;
+  uint32_t tail = q->tail;
+  while (tail != q->head) {
+    __mem_fence_acquire(); // the event is complete
+    const synth_event_t *ev = &q->event[tail & (SYNTH_EVENT_QUEUE_SIZE - 1)];
+    int32_t lateness = now - ev->time;
+    if (lateness < 0) { break; } // not due yet
+    q->max_lateness += (lateness > (int32_t) q->max_lateness) *
+                       (lateness - q->max_lateness);
+    apply_event(synth, ev);
+    __mem_fence_release(); // done with the slot before it is reused
+    q->tail = ++tail;
+  }
+}
+
+// Frames that can be rendered, at most max, before the next pending event
+static size_t frames_to_next_event(synth_t *synth, size_t max) {
+  synth_event_queue_t *q = &synth->events;
+  uint32_t tail = q->tail;
+  if (tail == q->head) { return max; }
+  __mem_fence_acquire();
+  int32_t frames = q->event[tail & (SYNTH_EVENT_QUEUE_SIZE - 1)].time -
+                   synth->frame_count;
+  return (frames > 0 && (size_t) frames < max) ? (size_t) frames : max;
+}
+
+static void apply_event(synth_t *synth, const synth_event_t *ev) {
+  switch (ev->type) {
+    case SYNTH_EVENT_NOTE_ON:         apply_note_on(synth, ev->key);                          break;
+    case SYNTH_EVENT_NOTE_OFF:        apply_note_off(synth, ev->key);                         break;
+    case SYNTH_EVENT_NOTE_TOGGLE:     apply_note_toggle(synth, ev->key);                      break;
+    case SYNTH_EVENT_ALL_NOTES_OFF:   apply_all_notes_off(synth);                             break;
+    case SYNTH_EVENT_CONTROL_MESSAGE: apply_control_message(synth, ev->message);              break;
+    case SYNTH_EVENT_SET_PARAMETER:   apply_set_parameter(synth, ev->set.parameter, ev->set.value); break;
+    case SYNTH_EVENT_LOAD_PRESET:     apply_load_preset(synth, &ev->preset);                  break;
+    case SYNTH_EVENT_SET_CONTROL_PERIOD: apply_control_period(synth, ev->control_shift);      break;
+    case SYNTH_EVENT_SET_STEREO:
+      apply_stereo(synth, ev->stereo.pan, ev->stereo.spread, ev->stereo.width);
+      break;
+    case SYNTH_EVENT_SET_PAN:
+      apply_stereo(synth, ev->stereo.pan, synth->spread, synth->width);
+      break;
+  }
+}
+
+void synth_note_toggle(synth_t *synth, uint8_t key) {
+  post_event(synth, (synth_event_t) { .type = SYNTH_EVENT_NOTE_TOGGLE, .key = key });
+}
+
+void synth_note_on(synth_t *synth, uint8_t key) {
+  post_event(synth, (synth_event_t) { .type = SYNTH_EVENT_NOTE_ON, .key = key });
+}
+
+void synth_note_off(synth_t *synth, uint8_t key) {
+  post_event(synth, (synth_event_t) { .type = SYNTH_EVENT_NOTE_OFF, .key = key });
+}
+
+void synth_all_notes_off(synth_t *synth) {
+  post_event(synth, (synth_event_t) { .type = SYNTH_EVENT_ALL_NOTES_OFF });
+}
+
+void synth_load_preset(synth_t *synth, Preset_t preset) {
+  post_event(synth, (synth_event_t) { .type = SYNTH_EVENT_LOAD_PRESET, .preset = preset });
+}
+
+void synth_control_message(synth_t *synth, control_message_t message) {
+  post_event(synth, (synth_event_t) { .type = SYNTH_EVENT_CONTROL_MESSAGE, .message = message });
+}
+
+void synth_set_parameter(synth_t *synth, synth_parameter_t parameter, int8_t value) {
+  post_event(synth, (synth_event_t) { .type = SYNTH_EVENT_SET_PARAMETER,
+                                      .set = { parameter, value } });
+}
+
+void synth_startup_chord(synth_t *synth) {
+  synth_note_on(synth, 60); synth_note_on(synth, 64);
+  synth_note_on(synth, 67); synth_note_on(synth, 71);
+}
+
+int8_t synth_get_octave_shift(synth_t *synth) {
+  return synth_get_settings(synth)->Octave_shift;
+}
+
+void synth_print_status(synth_t *synth){
+  const Preset_t *p = synth_get_settings(synth);
+  printf("Pitch             : [");
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    printf(" %3hhu%s", synth->pitch_voice[id], (id + 1 < SYNTH_NUM_VOICES) ? "," : " ]\n");
+  }
+  printf("Gate              : [");
+  for (uint8_t id = 0; id < SYNTH_NUM_VOICES; ++id) {
+    printf(" %3hhu%s", synth->gate_voice[id], (id + 1 < SYNTH_NUM_VOICES) ? "," : " ]\n");
+  }
+  printf("Octave Shift      : %+3hd\n",       p->Octave_shift);
+  printf("Osc Waveform      : %3hhu\n",       p->Osc_waveform);
+  printf("Osc 2 Coarse Pitch: %+3hd\n",       p->Osc_2_coarse_pitch);
+  printf("Osc 2 Fine Pitch  : %+3hd\n",       p->Osc_2_fine_pitch);
+  printf("Osc 1/2 Mix       : %3hhu\n",       p->Osc_1_2_mix);
+  printf("Filter Cutoff     : %3hhu\n",       p->Filter_cutoff);
+  printf("Filter Resonance  : %3hhu\n",       p->Filter_resonance);
+  printf("Filter EG Amount  : %+3hd\n",       p->Filter_mod_amount);
+  printf("EG Decay Time     : %3hhu\n",       p->EG_decay_time);
+  printf("EG Sustain Level  : %3hhu\n",       p->EG_sustain_level);
+  printf("LFO Depth         : %3hhu\n",       p->LFO_depth);
+  printf("LFO Rate          : %3hhu\n",       p->LFO_rate);
+  printf("Instance Memory   : %u bytes\n",    (unsigned) sizeof(synth_t));
+  printf("Shared Tables     : %u bytes\n",    (unsigned) synth_tables_size());
+  synth_load_t load;
+  get_output_load(&load);
   printf("Start Time        : %4hu/%4hu\n",   start_time, max_start_time);
-  printf("Processing Time   : %4hu/%4hu\n\n", proc_time, max_proc_time);
+  printf("Output Load       : %3u.%02u%% avg, %3u.%02u%% peak\n",
+         load.average_load / 100, load.average_load % 100,
+         load.peak_load / 100, load.peak_load % 100);
+  printf("Cycles per Block  : %6lu avg, %6lu peak\n\n",
+         (unsigned long) load.average_cycles, (unsigned long) load.peak_cycles);
+}
+
+void synth_set_steal_policy(synth_t *synth, synth_steal_policy_t policy) {
+  synth->steal_policy = policy;
+}
+
+bool synth_set_stereo(synth_t *synth, int8_t pan, uint8_t spread,
+                      uint8_t width) {
+  if (pan < -32 || pan > 32 || spread > 32 || width > 128) { return false; }
+  synth_event_t event = { .time = synth->frame_count,
+                          .type = SYNTH_EVENT_SET_STEREO,
+                          .stereo = { pan, spread, width } };
+  return synth_post_event(synth, &event);
+}
+
+bool synth_set_pan(synth_t *synth, int8_t pan) {
+  if (pan < -32 || pan > 32) { return false; }
+  synth_event_t event = { .time = synth->frame_count,
+                          .type = SYNTH_EVENT_SET_PAN,
+                          .stereo = { .pan = pan } };
+  return synth_post_event(synth, &event);
+}
+
+bool synth_set_control_period(synth_t *synth, uint8_t samples) {
+  uint8_t shift = 0;
+  while ((1u << shift) < samples) { ++shift; }
+  if (samples == 0 || samples != (1u << shift) ||
+      samples > SYNTH_MAX_CONTROL_PERIOD) { return false; }
+  synth_event_t event = { .time = synth->frame_count,
+                          .type = SYNTH_EVENT_SET_CONTROL_PERIOD,
+                          .control_shift = shift };
+  return synth_post_event(synth, &event);
 }
 
+size_t synth_tables_size() {
+  return sizeof(Osc_freq_table) + sizeof(Osc_tune_table) +
+         sizeof(Osc_wave_tables) + sizeof(Osc_mix_table) +
+         sizeof(LFO_freq_table) + sizeof(EG_exp_table) +
+         sizeof(Filter_coefs_table);
+}
+
+//////// Functions for the default engine //////////////////
+void note_toggle(uint8_t key) { synth_note_toggle(&synth, key); }
+void note_on(uint8_t key) { synth_note_on(&synth, key); }
+void note_off(uint8_t key) { synth_note_off(&synth, key); }
+void all_notes_off() { synth_all_notes_off(&synth); }
+void startup_chord() { synth_startup_chord(&synth); }
+int8_t get_octave_shift() { return synth_get_octave_shift(&synth); }
+void load_preset(Preset_t preset) { synth_load_preset(&synth, preset); }
+void control_message(control_message_t message) { synth_control_message(&synth, message); }
+void set_parameter(synth_parameter_t parameter, int8_t value) { synth_set_parameter(&synth, parameter, value); }
+void print_status() { synth_print_status(&synth); }
+bool set_control_period(uint8_t samples) { return synth_set_control_period(&synth, samples); }
+void set_steal_policy(synth_steal_policy_t policy) { synth_set_steal_policy(&synth, policy); }
+bool set_stereo(int8_t pan, uint8_t spread, uint8_t width) { return synth_set_stereo(&synth, pan, spread, width); }
+bool set_pan(int8_t pan) { return synth_set_pan(&synth, pan); }
+
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
@@ -92,41 +92,272 @@ typedef enum {
 typedef int32_t Q28; // Signed fixed-point number with 28-bit fractional part
 typedef int16_t Q14; // Signed fixed-point number with 14-bit fractional part
 
+#ifndef SYNTH_NUM_VOICES
+#define SYNTH_NUM_VOICES 4 // polyphony (1 to 32)
+#endif
+
+#ifndef SYNTH_MAX_CONTROL_PERIOD
+#define SYNTH_MAX_CONTROL_PERIOD 32 // longest control period (samples)
+#endif
+
+#ifndef SYNTH_DUAL_CORE
+#define SYNTH_DUAL_CORE 0 // allow rendering half of the voices on core 1
+#endif
+
+#ifndef SYNTH_IDLE_LEVEL
+#define SYNTH_IDLE_LEVEL (1 << 14) // EG level (about -60 dB) below which a released voice stops
+#endif
+
+#ifndef SYNTH_EVENT_QUEUE_SIZE
+#define SYNTH_EVENT_QUEUE_SIZE 32 // pending events per engine (power of 2)
+#endif
+
+#ifndef SYNTH_PWM_DMA
+#define SYNTH_PWM_DMA 1 // feed the PWM output from DMA (0: an interrupt per sample)
+#endif
+
+#ifndef SYNTH_PWM_BLOCK_FRAMES
+#define SYNTH_PWM_BLOCK_FRAMES 64 // frames per PWM DMA buffer (two of them)
+#endif
+
+// Voice chosen for a new note when all the voices are held. A note that
+// is already held always retriggers its own voice.
+typedef enum {
+  SYNTH_STEAL_OLDEST,     // the note started first
+  SYNTH_STEAL_QUIETEST,   // the voice with the lowest EG level
+  SYNTH_STEAL_SAME_PITCH, // oldest, and a released voice of the same pitch
+                          // is retriggered instead of starting another
+} synth_steal_policy_t;
+
+// Note and control events, applied by the renderer
+typedef enum {
+  SYNTH_EVENT_NOTE_ON,
+  SYNTH_EVENT_NOTE_OFF,
+  SYNTH_EVENT_NOTE_TOGGLE,
+  SYNTH_EVENT_ALL_NOTES_OFF,
+  SYNTH_EVENT_CONTROL_MESSAGE,
+  SYNTH_EVENT_SET_PARAMETER,
+  SYNTH_EVENT_LOAD_PRESET,
+  SYNTH_EVENT_SET_CONTROL_PERIOD,
+  SYNTH_EVENT_SET_STEREO,
+  SYNTH_EVENT_SET_PAN,
+} synth_event_type_t;
+
+typedef struct {
+  uint32_t time;               // due frame, on the engine's frame_count clock
+  uint8_t  type;               // synth_event_type_t
+  union {
+    uint8_t key;               // NOTE_ON, NOTE_OFF, NOTE_TOGGLE
+    uint8_t message;           // CONTROL_MESSAGE (control_message_t)
+    struct {
+      uint8_t parameter;       // synth_parameter_t
+      int8_t  value;
+    } set;                     // SET_PARAMETER
+    Preset_t preset;           // LOAD_PRESET
+    uint8_t control_shift;     // SET_CONTROL_PERIOD (log2 samples)
+    struct {
+      int8_t  pan;
+      uint8_t spread;
+      uint8_t width;
+    } stereo;                  // SET_STEREO, SET_PAN (pan only)
+  };
+} synth_event_t;
+
+// Single-producer/single-consumer ring: one context posts the events of
+// an engine, in time order. The renderer applies them on their frame,
+// ending its blocks early when an event falls inside.
+typedef struct {
+  synth_event_t event[SYNTH_EVENT_QUEUE_SIZE];
+  volatile uint32_t head;      // events posted (written by the producer)
+  volatile uint32_t tail;      // events applied (written by the renderer)
+  uint32_t dropped;            // events lost because the queue was full
+  uint32_t max_depth;          // highest number of pending events seen
+  uint32_t max_lateness;       // most frames an event was applied late
+} synth_event_queue_t;
+
+// DSP state of one voice, in processing order
+typedef struct {
+  uint32_t lfo_phase;        // LFO phase
+  int32_t  eg_level;         // EG output level current value
+  uint32_t eg_decay_counter; // EG decay counter
+  uint8_t  eg_gate;          // EG gate input level current value
+  uint8_t  eg_attack_phase;  // EG current attack phase
+  uint16_t filter_cutoff;    // Filter cutoff current value
+  uint32_t osc_phase_1;      // Oscillator 1 phase
+  uint32_t osc_phase_2;      // Oscillator 2 phase
+  Q28      filter_x1, filter_x2, filter_y1, filter_y2; // Filter history
+  uint32_t osc_inc_1, osc_inc_2; // Oscillator increments (control rate)
+  uint8_t  osc_pitch;        // Pitch of the increments (control rate)
+  uint8_t  active;           // Rendered (cleared once silent with gate off)
+} synth_voice_t;
+
+// One engine, with its own settings and voice pool.
+// Engines share the read-only tables, so any number can run at once.
+typedef struct {
+  synth_voice_t voice[SYNTH_NUM_VOICES];          // DSP state (per voice)
+  uint8_t gate_voice[SYNTH_NUM_VOICES];  // gate control value (per voice)
+  uint8_t pitch_voice[SYNTH_NUM_VOICES]; // pitch control value (per voice)
+  uint8_t voice_of_pitch[256];     // voice that last played each pitch
+  uint8_t voice_prev[SYNTH_NUM_VOICES]; // voice lists (held, released)
+  uint8_t voice_next[SYNTH_NUM_VOICES];
+  uint8_t held_first, held_last;   // held voices, oldest note first
+  uint8_t free_first, free_last;   // released voices, oldest release first
+  uint8_t allocator_ready;         // lists built (on the first note)
+  uint8_t steal_policy;            // synth_steal_policy_t
+  uint32_t steal_count;            // held notes cut to start another
+  uint8_t control_shift;           // control period (log2 samples)
+  int8_t pan;                      // stereo position, -32 (left) to 32
+  uint8_t spread;                  // voices fanned out around it, 0-32
+  uint8_t width;                   // side level of the spread, 64 = 1.0
+  uint16_t pan_cut[2];             // Q14 gain taken off left and right
+  uint16_t voice_pan_cut[SYNTH_NUM_VOICES][2]; // same, for the spread
+  Preset_t settings[2];            // setting values, double-buffered
+  volatile uint32_t settings_version; // publish count (low bit: active copy)
+  volatile uint32_t frame_count;   // frames rendered so far (event clock)
+  synth_event_queue_t events;      // events waiting for the renderer
+} synth_t;
+
+#ifndef SYNTH_MAX_OUTPUTS
+#define SYNTH_MAX_OUTPUTS 4 // engines that the audio outputs can mix
+#endif
+
+// Rendering load of the audio outputs, in cycles of the system clock
+// (measured with SysTick on the device, with the monotonic clock on the
+// host). A block is one synth_render() call for I2S, one sample for PWM;
+// its deadline is the time it takes to play. Loads are in hundredths of
+// a percent of the deadline.
+#define SYNTH_LOAD_BINS 11 // 0-10%, 10-20% ... 90-100%, then over 100%
+
+typedef struct {
+  uint32_t blocks;                    // blocks measured
+  uint32_t cycles;                    // last block
+  uint32_t average_cycles;            // moving average (1/16 per block)
+  uint32_t peak_cycles;
+  uint16_t load;                      // last block
+  uint16_t average_load;              // moving average
+  uint16_t peak_load;
+  uint32_t histogram[SYNTH_LOAD_BINS]; // blocks by load, 10% per bin
+} synth_load_t;
+
 #define ONE_Q28 ((Q28) (1 << 28)) // 1.0 for Q28 type
 #define ONE_Q14 ((Q14) (1 << 14)) // 1.0 for type Q14
 #define PI ((float) M_PI) // Pi in float type
-#define FCLKSYS (120000000) // system clock frequency (Hz)
-#define FS (44100) // sampling frequency (Hz)
+#define FCLKSYS (120000000) // default system clock frequency (Hz)
+#ifndef FS
+#define FS (44100) // default sampling frequency (Hz), that of the tables
+#endif
 #define FA (440.0F) // reference frequency (Hz)
+#define SYNTH_MIN_SAMPLE_RATE 16000
+#define SYNTH_MAX_SAMPLE_RATE 96000
 
-static inline Q28 Osc_phase_to_audio(uint32_t phase, uint8_t pitch);
-static inline Q28 Osc_process(uint8_t id,
-                              uint16_t full_pitch, Q14 pitch_mod_in);
-static inline int32_t mul_s32_s32_h32(int32_t x, int32_t y);
-
-static inline Q28 Filter_process(uint8_t id, Q28 audio_in, Q14 cutoff_mod_in);
-static inline Q28 Amp_process(uint8_t id, Q28 audio_in, Q14 gain_in);
-static inline Q14 EG_process(uint8_t id, uint8_t gate_in);
-static inline Q14 LFO_process(uint8_t id);
+// Set the system clock and the sample rate of the outputs (FCLKSYS and FS
+// at startup). The pitch, LFO, envelope and filter tables are derived for
+// the new rate, which takes a few ms. Call before starting the output,
+// with the clock already set; the I2S output takes the rate in its config.
+// False for a rate out of range, or once an output renders: after
+// PWMA_init(), start_i2s_dma_rendering() or a first i2s_timer_callback().
+bool set_output_rates(uint32_t sys_clock_hz, uint32_t sample_rate);
+uint32_t get_sample_rate();
+uint32_t get_sys_clock_hz();
+// Run the voices at half the sample rate and double the rate of the bus
+// with a half-band filter, which nearly halves the render time for
+// patches with nothing above a quarter of the rate. The tables are
+// derived for the lower rate as by set_output_rates(), and turning it off
+// gives back the tables of FS. Call before starting the output: false
+// for a change once an output renders, as with set_output_rates(). Not
+// with the per-sample PWM interrupt.
+bool set_half_rate_voices(bool enabled);
+bool get_half_rate_voices();
 
 bool i2s_timer_callback(repeating_timer_t *timer);
+// Render the I2S buffers as the DMA frees them, from a low-priority
+// interrupt, instead of polling with i2s_timer_callback(). Call after
+// sound_i2s_playback_start(); the free buffers are rendered right away.
+void start_i2s_dma_rendering();
+void stop_i2s_dma_rendering();
 
-static void pwm_irq_handler();
+// Start the PWM output. With SYNTH_PWM_DMA, blocks are rendered as for
+// I2S and written to the compare registers by DMA on every PWM wrap.
+// Pins on two slices hold the other channel of their slice at 0.
 void PWMA_init(int8_t pwm_gpio_r, int8_t pwm_gpio_l);
-static inline void PWMA_process(Q28 audio_in);
-static inline Q28 process_voice(uint8_t id);
-static void pwm_irq_handler();
+// Requantize the PWM output with noise shaping of order 1 or 2, which
+// moves the noise of the 12-bit levels above the low and mid band, or
+// truncate it (0, the default)
+bool set_pwm_noise_shaping(uint8_t order);
+// Render frames of 16-bit stereo audio, one 32-bit word per frame with
+// the left channel in the upper half (as the I2S output sends it); out
+// must be 32-bit aligned
+void synth_render_block(int16_t *out, size_t frames);
+// Render several engines mixed together
+void synth_render(synth_t *const *synths, uint8_t num_synths,
+                  int16_t *out, size_t frames);
+// Choose the engines that the I2S and PWM outputs mix (default engine only
+// at startup). Call before the output is started.
+bool set_output_synths(synth_t *const *synths, uint8_t count);
+// With SYNTH_DUAL_CORE=1: launch core 1 to render the upper half of the
+// voices of synth_render() calls (I2S output). Core 1 must be free.
+void start_dual_core_rendering();
+void stop_dual_core_rendering();
+// Reset an engine: settings of presets[0], all voices off, DSP state clear
+void synth_init(synth_t *synth);
+// The default engine, used by the functions without a synth_t argument
+synth_t *get_synth_state();
+// Memory shared by all engines (bytes)
+size_t synth_tables_size();
+// Copy of the output load figures (updated by the rendering context, so a
+// copy can mix two consecutive blocks), and restart of the measurement
+void get_output_load(synth_load_t *load);
+void reset_output_load();
+
+// Queue an event (from one producer context per engine). Returns false
+// and counts a drop when the queue is full. The functions below queue
+// their event for the current frame.
+bool synth_post_event(synth_t *synth, const synth_event_t *event);
+
+void synth_note_toggle(synth_t *synth, uint8_t key);
+void synth_all_notes_off(synth_t *synth);
+void synth_note_on(synth_t *synth, uint8_t key);
+void synth_note_off(synth_t *synth, uint8_t key);
+void synth_startup_chord(synth_t *synth);
+int8_t synth_get_octave_shift(synth_t *synth);
+void synth_load_preset(synth_t *synth, Preset_t preset);
+void synth_control_message(synth_t *synth, control_message_t message);
+void synth_set_parameter(synth_t *synth, synth_parameter_t parameter, int8_t value);
+void synth_print_status(synth_t *synth);
+// Current setting values (changed by presets, control messages and
+// parameters, which publish a complete new copy at once)
+const Preset_t *synth_get_settings(synth_t *synth);
+// Evaluate the EG, the LFO and the filter cutoff once every samples
+// (1, 2, 4 ... SYNTH_MAX_CONTROL_PERIOD) in synth_render(). 1, the
+// default, is per sample. The PWM output always runs per sample.
+// Queued as an event: false for another period or a full queue.
+bool synth_set_control_period(synth_t *synth, uint8_t samples);
+void synth_set_steal_policy(synth_t *synth, synth_steal_policy_t policy);
+// Stereo image: pan -32 (left) to 32 (right) places the engine, spread
+// 0-32 fans its voices out around it (voice 0 furthest left), and width
+// 0 (mono) to 128 scales the difference between the channels of the
+// spread voices (64: as placed). Pans keep the level of the centre.
+// Engines start centred and mono: 0, 0, 64. Queued as an event, as is
+// synth_set_pan(), which keeps the spread and width: false for values
+// out of range or a full queue.
+bool synth_set_stereo(synth_t *synth, int8_t pan, uint8_t spread,
+                      uint8_t width);
+bool synth_set_pan(synth_t *synth, int8_t pan);
+
 void note_toggle(uint8_t key);
 void all_notes_off();
 void note_on(uint8_t key);
 void note_off(uint8_t key);
 void startup_chord();
 int8_t get_octave_shift();
-static void load_factory_preset(uint8_t preset);
 void load_preset(Preset_t preset);
 void control_message(control_message_t message);
 void set_parameter(synth_parameter_t parameter, int8_t value);
 void print_status();
+bool set_control_period(uint8_t samples);
+void set_steal_policy(synth_steal_policy_t policy);
+bool set_stereo(int8_t pan, uint8_t spread, uint8_t width);
+bool set_pan(int8_t pan);
 
 #ifdef __cplusplus
 }
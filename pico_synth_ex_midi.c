@@ -0,0 +1,128 @@
+/* pico_synth_ex_midi
+ * Streaming MIDI 1.0 input for pico_synth_ex
+ * Licensed under a MIT-0 license
+ *
+ */
+
+#include "pico_synth_ex_midi.h"
+
+// Controllers mapped to parameters, scaled from 0-127 to the parameter
+// range. Sound controllers 70-79 follow their General MIDI 2 meaning
+// where the synth has one.
+typedef struct {
+  uint8_t parameter_1; // synth_parameter_t + 1, 0 when not mapped
+  uint8_t max;         // value of the parameter at 127
+} cc_mapping_t;
+
+static const cc_mapping_t cc_mappings[128] = {
+  [1]  = { LFO_DEPTH + 1,          64 }, // modulation wheel
+  [16] = { OSC_1_2_MIX + 1,        64 }, // general purpose 1-4
+  [17] = { OSC_2_COARSE_PITCH + 1, 24 },
+  [18] = { OSC_2_FINE_PITCH + 1,   32 },
+  [19] = { FILTER_MOD_AMOUNT + 1,  60 },
+  [70] = { OSC_WAVEFORM + 1,        1 }, // sound variation
+  [71] = { FILTER_RESONANCE + 1,    5 }, // timbre / harmonic intensity
+  [74] = { FILTER_CUTOFF + 1,     120 }, // brightness
+  [75] = { EG_DECAY_TIME + 1,      64 }, // decay time
+  [76] = { LFO_RATE + 1,           64 }, // vibrato rate
+  [79] = { EG_SUSTAIN_LEVEL + 1,   64 }, // sound controller 10
+};
+
+#define CC_PAN           10  // the stereo position of the engine
+#define CC_ALL_SOUND_OFF 120
+#define CC_ALL_NOTES_OFF 123 // 124-127 (omni and mono/poly) imply it too
+
+// Data bytes of a message, by the high nibble of its status (channel
+// messages) or by its low nibble (system common, 0xF0-0xF7)
+static const uint8_t channel_lengths[8] = { 2, 2, 2, 2, 1, 1, 2, 0 };
+static const uint8_t common_lengths[8]  = { 0, 1, 2, 1, 0, 0, 0, 0 };
+
+void synth_midi_init(synth_midi_t *midi, synth_t *synth, uint8_t channel) {
+  *midi = (synth_midi_t) { 0 };
+  midi->synth = synth;
+  midi->channel = channel;
+}
+
+static void control_change(synth_midi_t *midi, uint8_t cc, uint8_t value) {
+  const cc_mapping_t *m = &cc_mappings[cc];
+  if (m->parameter_1) {
+    synth_set_parameter(midi->synth, m->parameter_1 - 1,
+                        (value * m->max + 63) / 127);
+  } else if (cc == CC_PAN) {
+    synth_set_pan(midi->synth, (value * 64 + 63) / 127 - 32);
+  } else if (cc == CC_ALL_SOUND_OFF || cc >= CC_ALL_NOTES_OFF) {
+    synth_control_message(midi->synth, ALL_NOTES_OFF);
+  } else {
+    ++midi->ignored;
+    return;
+  }
+  ++midi->messages;
+}
+
+// A complete message, with data_1 and the last data byte
+static void dispatch(synth_midi_t *midi, uint8_t data_2) {
+  uint8_t status = midi->status;
+  if (status >= 0xF0 ||
+      (midi->channel != SYNTH_MIDI_OMNI && (status & 0x0F) != midi->channel)) {
+    ++midi->ignored; // system common, or another channel
+    return;
+  }
+  uint8_t data_1 = (midi->length == 2) ? midi->data_1 : data_2;
+  switch (status >> 4) {
+    case 0x9:
+      if (data_2 != 0) { synth_note_on(midi->synth, data_1); break; }
+      // A note on with velocity 0 is a note off
+      // fall through
+    case 0x8:
+      synth_note_off(midi->synth, data_1);
+      break;
+    case 0xB:
+      control_change(midi, data_1, data_2);
+      return;
+    case 0xC:
+      if (data_1 >= 10) { ++midi->ignored; return; } // 10 factory presets
+      synth_control_message(midi->synth, PRESET_0 + data_1);
+      break;
+    default: // aftertouch and pitch bend
+      ++midi->ignored;
+      return;
+  }
+  ++midi->messages;
+}
+
+static inline void parse_byte(synth_midi_t *midi, uint8_t byte) {
+  if (byte < 0x80) { // data
+    if (midi->status == 0 || midi->in_sysex) { return; }
+    if (++midi->count < midi->length) {
+      midi->data_1 = byte;
+      return;
+    }
+    midi->count = 0;
+    dispatch(midi, byte);
+    if (midi->status >= 0xF0) { midi->status = 0; } // no running status
+  } else if (byte >= 0xF8) {
+    // Realtime (clock, start, stop, active sensing, reset): may come
+    // between the bytes of any message, which goes on unchanged
+  } else if (byte >= 0xF0) {
+    // System common ends a SysEx message and cancels the running status
+    midi->in_sysex = (byte == 0xF0);
+    midi->length = common_lengths[byte & 0x07];
+    midi->status = midi->length ? byte : 0;
+    midi->count = 0;
+  } else {
+    midi->in_sysex = 0;
+    midi->status = byte;
+    midi->length = channel_lengths[(byte >> 4) & 0x07];
+    midi->count = 0;
+  }
+}
+
+void synth_midi_parse_byte(synth_midi_t *midi, uint8_t byte) {
+  parse_byte(midi, byte);
+}
+
+void synth_midi_parse(synth_midi_t *midi, const uint8_t *bytes, size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    parse_byte(midi, bytes[i]);
+  }
+}
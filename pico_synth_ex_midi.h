@@ -0,0 +1,46 @@
+/* pico_synth_ex_midi
+ * Streaming MIDI 1.0 input for pico_synth_ex: raw bytes from a UART,
+ * USB or a file go in, note, controller and program events come out
+ * on an engine. Licensed under a MIT-0 license
+ *
+ */
+
+#ifndef PICO_SYNTH_EX_MIDI_H_
+#define PICO_SYNTH_EX_MIDI_H_
+
+#include "pico_synth_ex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYNTH_MIDI_OMNI 0xFF // listen to all channels
+
+// Parser state: a few bytes, no buffers. Zero-initialized it is valid but
+// drives no engine; set it up with synth_midi_init().
+typedef struct {
+  synth_t *synth;     // engine driven by the messages
+  uint8_t channel;    // channel listened to (0-15) or SYNTH_MIDI_OMNI
+  uint8_t status;     // running status, 0 when there is none
+  uint8_t length;     // data bytes of the current message
+  uint8_t count;      // data bytes received so far
+  uint8_t data_1;     // first data byte
+  uint8_t in_sysex;   // skipping a System Exclusive message
+  uint32_t messages;  // messages that reached the engine
+  uint32_t ignored;   // complete messages with no use here
+} synth_midi_t;
+
+// Listen to channel (0-15, or SYNTH_MIDI_OMNI) on behalf of synth. The
+// parser posts events to the engine, so it must be the only producer of
+// that engine (feed it from a single ISR or thread).
+void synth_midi_init(synth_midi_t *midi, synth_t *synth, uint8_t channel);
+// Feed one byte, for example from a UART interrupt
+void synth_midi_parse_byte(synth_midi_t *midi, uint8_t byte);
+// Feed a buffer of bytes
+void synth_midi_parse(synth_midi_t *midi, const uint8_t *bytes, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
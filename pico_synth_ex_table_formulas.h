@@ -0,0 +1,100 @@
+/* pico_synth_ex_table_formulas.h
+ * The formulas the tables of pico_synth_ex_tables.h were made with, in
+ * single precision as they were. The engine derives the tables that
+ * depend on the sample rate with them (set_output_rates()), and the host
+ * tool synth_tables generates the whole header from them.
+ */
+
+#ifndef PICO_SYNTH_EX_TABLE_FORMULAS_H_
+#define PICO_SYNTH_EX_TABLE_FORMULAS_H_
+
+#include <stdint.h>
+#include <math.h>
+
+struct FILTER_COEFS { int32_t b0_a0, a1_a0, a2_a0; }; // Q28 Filter coefficients
+
+#ifndef OSC_WAVE_TABLE_BITS
+#define OSC_WAVE_TABLE_BITS 9 // log2 samples per wave table (at most 18)
+#endif
+#define OSC_WAVE_TABLE_SIZE (1 << OSC_WAVE_TABLE_BITS)
+#define OSC_WAVE_MAX_HARMONICS 127 // harmonics of the lowest wave tables
+// The rate that the decay times and the highest cutoff were chosen at:
+// the ratio of the formulas below is the rate over this one, whatever FS
+#define FORMULA_REFERENCE_RATE 44100.0F
+
+// Phase increment of note i (0-121) at rate fs; the low 4 bits are 0001
+static inline uint32_t formula_osc_freq(uint8_t i, float fs) {
+  float freq = 440.0F * powf(2.0F, (i - 69) / 12.0F);
+  return (((uint32_t) (freq * 4294967296.0F / fs)) >> 4 << 4) | 1;
+}
+
+// Q14 increase of the frequency (index 128 + n, n/256 of a semitone).
+// Index 0 (half a semitone down) has always been stored positive.
+static inline int16_t formula_osc_tune(uint8_t i) {
+  int16_t tune = (int16_t) ((powf(2.0F, (i - 128) / 3072.0F) - 1.0F) * 16384);
+  return (i == 0) ? -tune : tune;
+}
+
+// Harmonics below fs/2 for every note of wave table k (notes 4k-3 to 4k,
+// plus a semitone of pitch modulation)
+static inline uint16_t formula_osc_harmonics(uint8_t k, float fs,
+                                             uint16_t max_harmonics) {
+  float freq = 440.0F * powf(2.0F, ((k * 4 + 1) - 69) / 12.0F);
+  uint32_t harmonics = (uint32_t) ((fs / 2) / freq);
+  return (harmonics < max_harmonics) ? harmonics : max_harmonics;
+}
+
+// Q14 sample n of a band-limited saw (waveform 0) or square (waveform 1)
+// of the given harmonics, one cycle over size samples
+static inline int16_t formula_osc_wave(uint8_t waveform, uint16_t harmonics,
+                                       uint32_t n, uint32_t size) {
+  float level = 0;
+  for (uint32_t h = 1; h <= harmonics; h += 1 + waveform) {
+    level += sinf(2 * (float) M_PI * h * n / size) / h;
+  }
+  return (int16_t) floorf(level * (16384 / (float) M_PI));
+}
+
+// Q14 constant-power gain of mix setting i (0-64)
+static inline int16_t formula_osc_mix(uint8_t i) {
+  return (int16_t) floorf(sqrtf((64 - i) / 64.0F) * 16384);
+}
+
+// Phase increment of LFO rate i (0-64): 0.2 Hz to 20 Hz
+static inline uint32_t formula_lfo_freq(uint8_t i, float fs) {
+  return (uint32_t) (0.2F * powf(10.0F, i / 32.0F) * 4294967296.0F / fs);
+}
+
+// Samples per decay step of decay time i (0-64), scaled by the ratio of
+// the rate to FORMULA_REFERENCE_RATE
+static inline uint32_t formula_eg_period(uint8_t i, float ratio) {
+  uint32_t period = (uint32_t) (powf(10.0F, i / 16.0F) * ratio);
+  return (period > 0) ? period : 1;
+}
+
+// The highest cutoff: that of step 480 (19.9 kHz), at the same fraction
+// of the rate below FORMULA_REFERENCE_RATE
+static inline float formula_filter_max_f0(float ratio) {
+  return 440.0F * powf(2.0F, (120 + 15 - 69) / 12.0F) *
+         ((ratio < 1.0F) ? ratio : 1.0F);
+}
+
+// Low-pass biquad of resonance r (0-5, Q 0.7 to 4) and cutoff step c
+// (0-480, quarter semitones from note 15), in the RBJ cookbook form
+static inline struct FILTER_COEFS formula_filter_coefs(uint8_t r, uint16_t c,
+                                                       float fs,
+                                                       float max_f0) {
+  float q = powf(2.0F, r / 2.0F) / sqrtf(2.0F);
+  float f0 = 440.0F * powf(2.0F, (c / 4.0F + 15 - 69) / 12.0F);
+  f0 = (f0 < max_f0) ? f0 : max_f0;
+  float w0 = 2.0F * (float) M_PI * f0 / fs;
+  float alpha = sinf(w0) / (2.0F * q);
+  float a0 = 1.0F + alpha;
+  struct FILTER_COEFS coefs;
+  coefs.b0_a0 = (int32_t) floorf((1.0F - cosf(w0)) / 2.0F / a0 * (1 << 28));
+  coefs.a1_a0 = (int32_t) floorf(-2.0F * cosf(w0) / a0 * (1 << 28));
+  coefs.a2_a0 = (int32_t) floorf((1.0F - alpha) / a0 * (1 << 28));
+  return coefs;
+}
+
+#endif
@@ -1,9 +1,9 @@
 #ifndef PICO_SYNTH_EX_TABLES_H_
 #define PICO_SYNTH_EX_TABLES_H_
 
-struct FILTER_COEFS { int32_t b0_a0, a1_a0, a2_a0; }; // Q28 Filter coefficients
+#include "pico_synth_ex_table_formulas.h"
 
-static const uint32_t Osc_freq_table[122] = {
+static uint32_t Osc_freq_table[122] = {
 796241,
 843601,
 893761,
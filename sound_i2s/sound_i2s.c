@@ -1,7 +1,5 @@
 /* sound_i2s.c */
 
-#include <stdlib.h>
-#include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/pio.h"
@@ -9,27 +7,20 @@
 #include "hardware/irq.h"
 
 #include "sound_i2s.h"
+#include "sound_i2s_ring.h"
 #include "sound_i2s_16bits.pio.h"
 
-volatile unsigned int sound_i2s_num_buffers_played = 0;
-
 static struct sound_i2s_config config;
 static PIO sound_pio;
 static uint sound_pio_sm;
 static uint sound_dma_chan;
 
-static volatile int sound_cur_buffer_num;
-static void *sound_sample_buffers[2];
-
 static void __isr __time_critical_func(dma_handler)(void)
 {
-  // swap buffers
-  uint cur_buf = !sound_cur_buffer_num;
-  sound_cur_buffer_num = cur_buf;
-  sound_i2s_num_buffers_played++;
+  void *buffer = sound_i2s_ring_advance();
 
   // set dma dest to new buffer and re-trigger dma:
-  dma_hw->ch[sound_dma_chan].al3_read_addr_trig = (uintptr_t) sound_sample_buffers[cur_buf];
+  dma_hw->ch[sound_dma_chan].al3_read_addr_trig = (uintptr_t) buffer;
 
   // ack dma irq
   dma_hw->ints0 = 1u << sound_dma_chan;
@@ -39,17 +30,9 @@ int sound_i2s_init(const struct sound_i2s_config *cfg)
 {
   config = *cfg;
 
-  // allocate sound buffers
-  size_t sound_buffer_size = 4 * SOUND_I2S_BUFFER_NUM_SAMPLES;
-  sound_sample_buffers[0] = malloc(sound_buffer_size);
-  sound_sample_buffers[1] = malloc(sound_buffer_size);
-  if (! sound_sample_buffers[0] || ! sound_sample_buffers[1]) {
-    free(sound_sample_buffers[0]);
-    free(sound_sample_buffers[1]);
+  if (sound_i2s_ring_init(&config) < 0) {
     return -1;
   }
-  memset(sound_sample_buffers[0], 0, sound_buffer_size);
-  memset(sound_sample_buffers[1], 0, sound_buffer_size);
 
   // setup pio
   sound_pio = (config.pio_num == 0) ? pio0 : pio1;
@@ -68,10 +51,7 @@ int sound_i2s_init(const struct sound_i2s_config *cfg)
 
 void sound_i2s_playback_start(void)
 {
-  // reset buffer
-  sound_i2s_num_buffers_played = 0;
-  sound_cur_buffer_num = 0;
-  void *buffer = sound_sample_buffers[sound_cur_buffer_num];
+  void *buffer = sound_i2s_ring_start();
 
   // start pio
   pio_sm_set_enabled(sound_pio, sound_pio_sm, true);
@@ -85,17 +65,7 @@ void sound_i2s_playback_start(void)
   dma_channel_configure(sound_dma_chan, &dma_cfg,
                         &sound_pio->txf[sound_pio_sm],  // destination
                         buffer,                         // source
-                        SOUND_I2S_BUFFER_NUM_SAMPLES,   // number of dma transfers
+                        sound_i2s_get_buffer_frames(),  // number of dma transfers
                         true                            // start immediatelly (will be blocked by pio)
                         );
 }
-
-void *sound_i2s_get_next_buffer(void)
-{
-  return sound_sample_buffers[1-sound_cur_buffer_num];
-}
-
-void *sound_i2s_get_buffer(int buffer_num)
-{
-  return sound_sample_buffers[buffer_num];
-}
@@ -9,21 +9,56 @@
 extern "C" {
 #endif
 
-#define SOUND_I2S_BUFFER_NUM_SAMPLES  1024
+#define SOUND_I2S_BUFFER_NUM_SAMPLES  1024 // default frames per buffer
+#define SOUND_I2S_NUM_BUFFERS         2    // default buffers in the ring
+#define SOUND_I2S_MAX_BUFFERS         8
 
 struct sound_i2s_config {
   uint8_t  pio_num;
   uint8_t  pin_scl;
   uint8_t  pin_sda;
   uint8_t  pin_ws;
-  uint16_t sample_rate;
+  uint32_t sample_rate;   // Hz
   uint8_t  bits_per_sample;
+  uint8_t  num_buffers;   // 2 to SOUND_I2S_MAX_BUFFERS, 0 for the default
+  uint16_t buffer_frames; // stereo frames per buffer, 0 for the default
 };
 
 int sound_i2s_init(const struct sound_i2s_config *cfg);
 void sound_i2s_playback_start(void);
 void *sound_i2s_get_next_buffer(void);
 void *sound_i2s_get_buffer(int buffer_num);
+unsigned int sound_i2s_get_num_buffers(void);
+unsigned int sound_i2s_get_buffer_frames(void);
+// Output latency: the time from rendering a frame to playing it while the
+// renderer keeps the whole ring filled
+uint32_t sound_i2s_get_latency_us(void);
+
+// Buffer ownership. A buffer is free once it has played, rendering between
+// sound_i2s_begin_render() and sound_i2s_end_render(), then ready until
+// the DMA plays it. begin returns the next buffer to render, in ring
+// order, if it is free, and NULL when the ring is full (or a render is
+// in progress).
+void *sound_i2s_begin_render(void);
+void sound_i2s_end_render(void *buffer);
+
+struct sound_i2s_stats {
+  unsigned int underruns;      // buffers that started playing unrendered
+                               // (stale, or partly rendered)
+  unsigned int double_renders; // renders of a buffer that was ready
+  int32_t      min_margin_us;  // least time left between the end of a
+                               // render and the start of its buffer
+                               // (negative: the buffer was late)
+};
+
+// Refill on demand: the callback runs each time the DMA frees a buffer,
+// in an interrupt of the lowest priority (the DMA interrupt is raised
+// above it, so a long render never holds up the next buffer). It should
+// render the free buffers with sound_i2s_begin_render(). NULL stops it.
+void sound_i2s_set_refill_callback(void (*callback)(void));
+
+void sound_i2s_get_stats(struct sound_i2s_stats *stats);
+void sound_i2s_reset_stats(void);
 
 extern volatile unsigned int sound_i2s_num_buffers_played;
 
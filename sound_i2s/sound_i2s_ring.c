@@ -0,0 +1,203 @@
+/* sound_i2s_ring.c */
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#include "sound_i2s_ring.h"
+
+volatile unsigned int sound_i2s_num_buffers_played = 0;
+
+static volatile int sound_cur_buffer_num;
+static int sound_num_buffers;
+static uint sound_buffer_frames;
+static void *sound_sample_buffers[SOUND_I2S_MAX_BUFFERS];
+
+// Buffer ownership, checked against the DMA
+enum { BUFFER_FREE, BUFFER_RENDERING, BUFFER_READY, BUFFER_PLAYING };
+static volatile uint8_t sound_buffer_state[SOUND_I2S_MAX_BUFFERS];
+static volatile int sound_render_buffer_num;    // next buffer to render
+static volatile uint32_t sound_buffer_start_us; // the playing buffer started
+static uint32_t sound_buffer_us;                // time to play a buffer
+static struct sound_i2s_stats sound_stats;
+
+// Refill interrupt, raised by the DMA interrupt
+static void (*volatile sound_refill_callback)(void);
+static int sound_refill_irq = -1;
+
+static inline int next_buffer_num(int num)
+{
+  return (num + 1 == sound_num_buffers) ? 0 : num + 1;
+}
+
+int sound_i2s_ring_init(const struct sound_i2s_config *cfg)
+{
+  sound_num_buffers = cfg->num_buffers ? cfg->num_buffers
+                                       : SOUND_I2S_NUM_BUFFERS;
+  sound_buffer_frames = cfg->buffer_frames ? cfg->buffer_frames
+                                           : SOUND_I2S_BUFFER_NUM_SAMPLES;
+  if (sound_num_buffers < 2 || sound_num_buffers > SOUND_I2S_MAX_BUFFERS) {
+    return -1;
+  }
+
+  // allocate sound buffers, as one ring
+  size_t sound_buffer_size = 4 * sound_buffer_frames;
+  uint8_t *ring = malloc(sound_buffer_size * sound_num_buffers);
+  if (! ring) {
+    return -1;
+  }
+  memset(ring, 0, sound_buffer_size * sound_num_buffers);
+  for (int i = 0; i < sound_num_buffers; i++) {
+    sound_sample_buffers[i] = ring + i * sound_buffer_size;
+  }
+  sound_buffer_us = (uint32_t) ((uint64_t) sound_buffer_frames * 1000000u /
+                                cfg->sample_rate);
+  return 0;
+}
+
+void *sound_i2s_ring_start(void)
+{
+  // reset buffer
+  sound_i2s_num_buffers_played = 0;
+  sound_cur_buffer_num = 0;
+  sound_buffer_state[0] = BUFFER_PLAYING; // silence
+  for (int i = 1; i < sound_num_buffers; i++) {
+    sound_buffer_state[i] = BUFFER_FREE;
+  }
+  sound_render_buffer_num = 1;
+  sound_buffer_start_us = time_us_32();
+  sound_i2s_reset_stats();
+  return sound_sample_buffers[sound_cur_buffer_num];
+}
+
+void *__time_critical_func(sound_i2s_ring_advance)(void)
+{
+  // next buffer of the ring
+  int cur_buf = next_buffer_num(sound_cur_buffer_num);
+  sound_buffer_state[sound_cur_buffer_num] = BUFFER_FREE;
+  if (sound_buffer_state[cur_buf] != BUFFER_READY) {
+    sound_stats.underruns++;
+    // the renderer fell behind: it goes on after this buffer
+    if (sound_buffer_state[cur_buf] == BUFFER_FREE &&
+        sound_render_buffer_num == cur_buf) {
+      sound_render_buffer_num = next_buffer_num(cur_buf);
+    }
+  }
+  sound_buffer_state[cur_buf] = BUFFER_PLAYING;
+  sound_buffer_start_us = time_us_32();
+  sound_cur_buffer_num = cur_buf;
+  sound_i2s_num_buffers_played++;
+  if (sound_refill_callback) {
+    irq_set_pending(sound_refill_irq);
+  }
+  return sound_sample_buffers[cur_buf];
+}
+
+void *sound_i2s_get_next_buffer(void)
+{
+  return sound_sample_buffers[next_buffer_num(sound_cur_buffer_num)];
+}
+
+void *sound_i2s_get_buffer(int buffer_num)
+{
+  return sound_sample_buffers[buffer_num];
+}
+
+unsigned int sound_i2s_get_num_buffers(void)
+{
+  return sound_num_buffers;
+}
+
+unsigned int sound_i2s_get_buffer_frames(void)
+{
+  return sound_buffer_frames;
+}
+
+uint32_t sound_i2s_get_latency_us(void)
+{
+  return sound_num_buffers * sound_buffer_us;
+}
+
+void *sound_i2s_begin_render(void)
+{
+  void *buffer = NULL;
+  uint32_t irq_state = save_and_disable_interrupts();
+  int num = sound_render_buffer_num;
+  if (sound_buffer_state[num] == BUFFER_FREE) {
+    sound_buffer_state[num] = BUFFER_RENDERING;
+    buffer = sound_sample_buffers[num];
+  }
+  restore_interrupts(irq_state);
+  return buffer;
+}
+
+void sound_i2s_end_render(void *buffer)
+{
+  uint32_t now = time_us_32();
+  uint32_t irq_state = save_and_disable_interrupts();
+  int num = 0;
+  while (num < sound_num_buffers && buffer != sound_sample_buffers[num]) {
+    num++;
+  }
+  if (num == sound_num_buffers) {
+    restore_interrupts(irq_state);
+    return;
+  }
+  int32_t margin;
+  if (sound_buffer_state[num] == BUFFER_PLAYING) {
+    // The DMA got there first: counted as an underrun when it did
+    margin = -(int32_t) (now - sound_buffer_start_us);
+  } else {
+    // It plays once the buffers before it in the ring have
+    int ahead = num - sound_cur_buffer_num;
+    if (ahead <= 0) ahead += sound_num_buffers;
+    sound_stats.double_renders += (sound_buffer_state[num] == BUFFER_READY);
+    sound_buffer_state[num] = BUFFER_READY;
+    margin = (int32_t) (sound_buffer_start_us +
+                        (uint32_t) ahead * sound_buffer_us - now);
+  }
+  if (margin < sound_stats.min_margin_us) sound_stats.min_margin_us = margin;
+  if (num == sound_render_buffer_num) {
+    sound_render_buffer_num = next_buffer_num(num);
+  }
+  restore_interrupts(irq_state);
+}
+
+static void refill_handler(void)
+{
+  void (*callback)(void) = sound_refill_callback;
+  if (callback) {
+    callback();
+  }
+}
+
+void sound_i2s_set_refill_callback(void (*callback)(void))
+{
+  if (sound_refill_irq < 0) {
+    sound_refill_irq = user_irq_claim_unused(true);
+    irq_set_exclusive_handler(sound_refill_irq, refill_handler);
+    irq_set_priority(sound_refill_irq, PICO_LOWEST_IRQ_PRIORITY);
+    irq_set_enabled(sound_refill_irq, true);
+    // the DMA interrupt must preempt a render
+    irq_set_priority(DMA_IRQ_0, PICO_DEFAULT_IRQ_PRIORITY);
+  }
+  sound_refill_callback = callback;
+}
+
+void sound_i2s_get_stats(struct sound_i2s_stats *stats)
+{
+  uint32_t irq_state = save_and_disable_interrupts();
+  *stats = sound_stats;
+  restore_interrupts(irq_state);
+}
+
+void sound_i2s_reset_stats(void)
+{
+  uint32_t irq_state = save_and_disable_interrupts();
+  sound_stats.underruns = 0;
+  sound_stats.double_renders = 0;
+  sound_stats.min_margin_us = INT32_MAX;
+  restore_interrupts(irq_state);
+}
@@ -0,0 +1,29 @@
+/* sound_i2s_ring.h
+ * Buffer ring of the I2S output, shared by the device driver (sound_i2s.c)
+ * and the host one (host/sound_i2s_host.c): buffer ownership, underruns,
+ * render margins and the refill interrupt. The drivers only move the
+ * samples, and call these from their DMA setup and interrupt.
+ */
+
+#ifndef SOUND_I2S_RING_H_FILE
+#define SOUND_I2S_RING_H_FILE
+
+#include "sound_i2s.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Allocate the ring for the config; 0, or -1 for a bad size or no memory
+int sound_i2s_ring_init(const struct sound_i2s_config *cfg);
+// Reset the ring, with the first buffer playing silence, and return it
+void *sound_i2s_ring_start(void);
+// The DMA is done with the playing buffer: free it and return the next one
+// of the ring, which it must play at once (from the DMA interrupt)
+void *sound_i2s_ring_advance(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SOUND_I2S_RING_H_FILE */